@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <sys/types.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "textrender.h"
+#include "pt1230.h"
+
+/*
+ * 1D barcode encoders
+ * Symbols are encoded into an array of modules (1 for black, 0 for white),
+ * including the quiet zones required by the symbology.
+ */
+
+#define CODE128_QUIET_ZONE	10
+#define CODE128_START_B		104
+#define CODE128_START_C		105
+#define CODE128_CODE_B		100
+#define CODE128_CODE_C		99
+#define CODE39_QUIET_ZONE	10
+#define CODE39_WIDE		3
+#define EAN13_QUIET_LEFT	11
+#define EAN13_QUIET_RIGHT	7
+
+static char* symbology_names[] = {
+	[SYMBOLOGY_CODE128] = "code128",
+	[SYMBOLOGY_EAN13] = "ean13",
+	[SYMBOLOGY_CODE39] = "code39",
+	[SYMBOLOGY_QR] = "qr",
+	[SYMBOLOGY_DATAMATRIX] = "datamatrix"
+};
+
+//bar and space widths in modules, starting with a bar
+static char* code128_patterns[] = {
+	"212222", "222122", "222221", "121223", "121322", "131222", "122213", "122312", "132212", "221213",
+	"221312", "231212", "112232", "122132", "122231", "113222", "123122", "123221", "223211", "221132",
+	"221231", "213212", "223112", "312131", "311222", "321122", "321221", "312212", "322112", "322211",
+	"212123", "212321", "232121", "111323", "131123", "131321", "112313", "132113", "132311", "211313",
+	"231113", "231311", "112133", "112331", "132131", "113123", "113321", "133121", "313121", "211331",
+	"231131", "213113", "213311", "213131", "311123", "311321", "331121", "312113", "312311", "332111",
+	"314111", "221411", "431111", "111224", "111422", "121124", "121421", "141122", "141221", "112214",
+	"112412", "122114", "122411", "142112", "142211", "241211", "221114", "413111", "241112", "134111",
+	"111242", "121142", "121241", "114212", "124112", "124211", "411212", "421112", "421211", "212141",
+	"214121", "412121", "111143", "111341", "131141", "114113", "114311", "411113", "411311", "113141",
+	"114131", "311141", "411131", "211412", "211214", "211232"
+};
+#define CODE128_STOP		"2331112"
+
+//wide elements of the 5 bars and 4 interleaved spaces, starting with a bar
+static char code39_alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. *$/+%";
+static char* code39_patterns[] = {
+	"000110100", "100100001", "001100001", "101100000", "000110001", "100110000", "001110000", "000100101",
+	"100100100", "001100100", "100001001", "001001001", "101001000", "000011001", "100011000", "001011000",
+	"000001101", "100001100", "001001100", "000011100", "100000011", "001000011", "101000010", "000010011",
+	"100010010", "001010010", "000000111", "100000110", "001000110", "000010110", "110000001", "011000001",
+	"111000000", "010010001", "110010000", "011010000", "010000101", "110000100", "011000100", "010010100",
+	"010101000", "010100010", "010001010", "000101010"
+};
+
+//left-hand odd parity (L) patterns, G and R patterns are derived from these
+static char* ean13_patterns[] = {
+	"0001101", "0011001", "0010011", "0111101", "0100011", "0110001", "0101111", "0111011", "0110111", "0001011"
+};
+//parity of the left half digits encoding the first digit, 1 selecting G
+static char* ean13_parity[] = {
+	"000000", "001011", "001101", "001110", "010011", "011001", "011100", "010101", "010110", "011010"
+};
+
+typedef struct /*_MODULES*/ {
+	uint8_t* data;
+	size_t length;
+	size_t max;
+} MODULES;
+
+static int modules_append(MODULES* modules, bool black, unsigned count){
+	if(modules->length + count > modules->max){
+		return -1;
+	}
+	memset(modules->data + modules->length, black ? 1 : 0, count);
+	modules->length += count;
+	return 0;
+}
+
+//append alternating bars and spaces of the given widths
+static int modules_widths(MODULES* modules, char* widths){
+	unsigned u;
+
+	for(u = 0; widths[u]; u++){
+		if(modules_append(modules, !(u % 2), widths[u] - '0') < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//append explicit module bits
+static int modules_bits(MODULES* modules, char* bits, bool invert){
+	unsigned u;
+
+	for(u = 0; bits[u]; u++){
+		if(modules_append(modules, (bits[u] == '1') != invert, 1) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static size_t digit_run(char* data, size_t length){
+	size_t u;
+
+	for(u = 0; u < length && isdigit(data[u]); u++){
+	}
+	return u;
+}
+
+//encode using code sets B and C, switching to C for longer runs of digits
+static int encode_code128(LOGGER logger, char* data, size_t length, MODULES* modules){
+	uint8_t values[BARCODE_MAX_MODULES / 11];
+	size_t count = 0, offset = 0, run;
+	unsigned checksum, u;
+	bool set_c;
+
+	run = digit_run(data, length);
+	set_c = (run >= 4 && !(run % 2)) || (run == length && run >= 2 && !(run % 2));
+	values[count++] = set_c ? CODE128_START_C : CODE128_START_B;
+
+	while(offset < length){
+		if(count + 3 >= sizeof(values)){
+			debug(logger, LOG_ERROR, "Barcode data too long\n");
+			return -1;
+		}
+
+		run = digit_run(data + offset, length - offset);
+		if(set_c){
+			if(run >= 2){
+				values[count++] = (data[offset] - '0') * 10 + (data[offset + 1] - '0');
+				offset += 2;
+				continue;
+			}
+			values[count++] = CODE128_CODE_B;
+			set_c = false;
+		}
+
+		//runs of digits are shorter in code set C, odd runs start in B
+		if(run >= 6 || (run >= 4 && run == length - offset)){
+			if(run % 2){
+				values[count++] = data[offset++] - ' ';
+			}
+			values[count++] = CODE128_CODE_C;
+			set_c = true;
+			continue;
+		}
+
+		if((uint8_t)data[offset] < ' ' || (uint8_t)data[offset] > 127){
+			debug(logger, LOG_ERROR, "Character %02X can not be encoded in Code128\n", (uint8_t)data[offset]);
+			return -1;
+		}
+		values[count++] = data[offset++] - ' ';
+	}
+
+	checksum = values[0];
+	for(u = 1; u < count; u++){
+		checksum += u * values[u];
+	}
+	values[count++] = checksum % 103;
+
+	if(modules_append(modules, false, CODE128_QUIET_ZONE) < 0){
+		return -1;
+	}
+	for(u = 0; u < count; u++){
+		if(modules_widths(modules, code128_patterns[values[u]]) < 0){
+			return -1;
+		}
+	}
+	if(modules_widths(modules, CODE128_STOP) < 0){
+		return -1;
+	}
+	return modules_append(modules, false, CODE128_QUIET_ZONE);
+}
+
+static int encode_code39_character(MODULES* modules, char* pattern){
+	unsigned u;
+
+	for(u = 0; pattern[u]; u++){
+		if(modules_append(modules, !(u % 2), (pattern[u] == '1') ? CODE39_WIDE : 1) < 0){
+			return -1;
+		}
+	}
+	//narrow inter-character gap
+	return modules_append(modules, false, 1);
+}
+
+static int encode_code39(LOGGER logger, char* data, size_t length, MODULES* modules){
+	char* start = code39_patterns[strchr(code39_alphabet, '*') - code39_alphabet];
+	char* character;
+	size_t u;
+
+	if(modules_append(modules, false, CODE39_QUIET_ZONE) < 0
+			|| encode_code39_character(modules, start) < 0){
+		return -1;
+	}
+
+	for(u = 0; u < length; u++){
+		character = strchr(code39_alphabet, toupper(data[u]));
+		if(!data[u] || data[u] == '*' || !character){
+			debug(logger, LOG_ERROR, "Character %02X can not be encoded in Code39\n", (uint8_t)data[u]);
+			return -1;
+		}
+		if(encode_code39_character(modules, code39_patterns[character - code39_alphabet]) < 0){
+			debug(logger, LOG_ERROR, "Barcode data too long\n");
+			return -1;
+		}
+	}
+
+	//the trailing gap is part of the quiet zone
+	if(encode_code39_character(modules, start) < 0){
+		return -1;
+	}
+	return modules_append(modules, false, CODE39_QUIET_ZONE - 1);
+}
+
+static int encode_ean13(LOGGER logger, char* data, size_t length, MODULES* modules){
+	char digits[14], reversed[8];
+	unsigned checksum = 0, u, v;
+
+	if((length != 12 && length != 13) || digit_run(data, length) != length){
+		debug(logger, LOG_ERROR, "EAN-13 requires 12 or 13 digits\n");
+		return -1;
+	}
+
+	memcpy(digits, data, 12);
+	for(u = 0; u < 12; u++){
+		checksum += (digits[u] - '0') * ((u % 2) ? 3 : 1);
+	}
+	digits[12] = '0' + (10 - checksum % 10) % 10;
+	digits[13] = 0;
+
+	if(length == 13 && data[12] != digits[12]){
+		debug(logger, LOG_ERROR, "Invalid EAN-13 check digit %c, expected %c\n", data[12], digits[12]);
+		return -1;
+	}
+
+	if(modules_append(modules, false, EAN13_QUIET_LEFT) < 0 || modules_bits(modules, "101", false) < 0){
+		return -1;
+	}
+
+	//left half in L or G (reversed R) patterns as selected by the first digit
+	for(u = 1; u < 7; u++){
+		if(ean13_parity[digits[0] - '0'][u - 1] == '1'){
+			for(v = 0; v < 7; v++){
+				reversed[v] = ean13_patterns[digits[u] - '0'][6 - v];
+			}
+			reversed[7] = 0;
+			if(modules_bits(modules, reversed, true) < 0){
+				return -1;
+			}
+		}
+		else if(modules_bits(modules, ean13_patterns[digits[u] - '0'], false) < 0){
+			return -1;
+		}
+	}
+
+	if(modules_bits(modules, "01010", false) < 0){
+		return -1;
+	}
+
+	//right half in R patterns
+	for(u = 7; u < 13; u++){
+		if(modules_bits(modules, ean13_patterns[digits[u] - '0'], true) < 0){
+			return -1;
+		}
+	}
+
+	if(modules_bits(modules, "101", false) < 0){
+		return -1;
+	}
+	return modules_append(modules, false, EAN13_QUIET_RIGHT);
+}
+
+int barcode_symbology(char* name){
+	unsigned u;
+
+	for(u = 0; u < sizeof(symbology_names) / sizeof(symbology_names[0]); u++){
+		if(!strcasecmp(name, symbology_names[u])){
+			return u;
+		}
+	}
+	return -1;
+}
+
+char* barcode_symbology_name(SYMBOLOGY symbology){
+	return symbology_names[symbology];
+}
+
+//encode data into modules, returns the number of modules including quiet zones
+ssize_t barcode_encode(LOGGER logger, SYMBOLOGY symbology, char* data, size_t max_modules, uint8_t* buffer){
+	MODULES modules = {
+		.data = buffer,
+		.length = 0,
+		.max = max_modules
+	};
+	int rv = -1;
+
+	switch(symbology){
+		case SYMBOLOGY_CODE128:
+			rv = encode_code128(logger, data, strlen(data), &modules);
+			break;
+		case SYMBOLOGY_EAN13:
+			rv = encode_ean13(logger, data, strlen(data), &modules);
+			break;
+		case SYMBOLOGY_CODE39:
+			rv = encode_code39(logger, data, strlen(data), &modules);
+			break;
+		default:
+			//2D symbologies are encoded by matrix_encode
+			break;
+	}
+
+	if(rv < 0){
+		debug(logger, LOG_ERROR, "Failed to encode %s barcode\n", symbology_names[symbology]);
+		return -1;
+	}
+	return modules.length;
+}
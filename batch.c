@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "textrender.h"
+#include "pt1230.h"
+
+/*
+ * CSV batch printing
+ * The input is read as CSV, the header row naming the template fields and every
+ * following row describing one label. Worker threads render the labels ahead into
+ * a bounded queue, each with its own copy of the configuration (and thus its own
+ * text renderer and field values), sharing the prepared static template layer.
+ * Queue slots are assigned by row, so labels leave the queue in input order
+ * regardless of which worker finished first.
+ */
+
+typedef struct /*_BATCH_LABEL*/ {
+	uint64_t* lines;
+	size_t length;
+	bool ready;
+	bool failed;
+} BATCH_LABEL;
+
+typedef struct /*_BATCH_WORKER*/ {
+	BATCH* batch;
+	CONF cfg;
+	pthread_t thread;
+	bool started;
+} BATCH_WORKER;
+
+struct BATCH {
+	char* data;
+	size_t columns;
+	char** names;
+	size_t rows;
+	char*** values;
+	size_t next_row;
+	size_t next_print;
+	bool abort;
+	BATCH_LABEL queue[BATCH_QUEUE_LENGTH];
+	pthread_mutex_t lock;
+	pthread_cond_t rendered;
+	pthread_cond_t consumed;
+	unsigned workers;
+	BATCH_WORKER* worker;
+};
+
+//split the next CSV record off the data, fields may be quoted with "" escaping quotes
+static char** csv_record(char** data, size_t* count){
+	char** fields = NULL;
+	char* read = *data;
+	char* write;
+	bool quoted = false;
+
+	*count = 0;
+	if(!*read){
+		return NULL;
+	}
+
+	//fields are unescaped in place
+	write = read;
+	while(true){
+		if(!(*count % 16)){
+			fields = realloc(fields, (*count + 16) * sizeof(char*));
+			if(!fields){
+				return NULL;
+			}
+		}
+		fields[(*count)++] = write;
+
+		for(; *read; read++){
+			if(quoted){
+				if(*read == '"' && read[1] == '"'){
+					*write++ = *read++;
+				}
+				else if(*read == '"'){
+					quoted = false;
+				}
+				else{
+					*write++ = *read;
+				}
+			}
+			else if(*read == '"'){
+				quoted = true;
+			}
+			else if(*read == ',' || *read == '\n' || (*read == '\r' && read[1] == '\n')){
+				break;
+			}
+			else{
+				*write++ = *read;
+			}
+		}
+
+		if(*read == ','){
+			*write++ = 0;
+			read++;
+			write = read;
+			continue;
+		}
+
+		//end of record
+		read += (*read == '\r') ? 2 : (*read == '\n') ? 1 : 0;
+		*write = 0;
+		*data = read;
+		return fields;
+	}
+}
+
+static int batch_parse(CONF* cfg, BATCH* batch, char* data){
+	char** fields;
+	size_t count;
+
+	//the header names the fields, empty records are skipped
+	while((fields = csv_record(&data, &count)) && count == 1 && !fields[0][0]){
+		free(fields);
+	}
+	if(!fields){
+		debug(cfg->logger, LOG_ERROR, "CSV input contains no header row\n");
+		return -1;
+	}
+	batch->names = fields;
+	batch->columns = count;
+
+	while((fields = csv_record(&data, &count))){
+		if(count == 1 && !fields[0][0]){
+			free(fields);
+			continue;
+		}
+		if(count != batch->columns){
+			debug(cfg->logger, LOG_WARNING, "CSV row %zu has %zu fields, expected %zu\n", batch->rows + 1, count, batch->columns);
+		}
+		//short rows leave the remaining fields empty
+		if(count < batch->columns){
+			fields = realloc(fields, batch->columns * sizeof(char*));
+			if(!fields){
+				debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+				return -1;
+			}
+			for(; count < batch->columns; count++){
+				fields[count] = "";
+			}
+		}
+
+		if(!(batch->rows % 64)){
+			batch->values = realloc(batch->values, (batch->rows + 64) * sizeof(char**));
+			if(!batch->values){
+				debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+				free(fields);
+				return -1;
+			}
+		}
+		batch->values[batch->rows++] = fields;
+	}
+	return 0;
+}
+
+static int worker_fields(BATCH_WORKER* worker, size_t row){
+	char assignment[DATA_BUFFER_LENGTH];
+	size_t u;
+
+	template_clear_fields(&(worker->cfg.template));
+	for(u = 0; u < worker->batch->columns; u++){
+		if(snprintf(assignment, sizeof(assignment), "%s=%s", worker->batch->names[u], worker->batch->values[row][u]) >= sizeof(assignment)){
+			debug(worker->cfg.logger, LOG_ERROR, "CSV field %s too long in row %zu\n", worker->batch->names[u], row + 1);
+			return -1;
+		}
+		if(template_field(&(worker->cfg), assignment) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void* batch_worker(void* context){
+	BATCH_WORKER* worker = (BATCH_WORKER*)context;
+	BATCH* batch = worker->batch;
+	uint64_t* lines;
+	size_t row, length = 0;
+
+	pthread_mutex_lock(&(batch->lock));
+	while(!batch->abort && batch->next_row < batch->rows){
+		//rendering ahead is limited by the queue length
+		row = batch->next_row;
+		if(row >= batch->next_print + BATCH_QUEUE_LENGTH){
+			pthread_cond_wait(&(batch->consumed), &(batch->lock));
+			continue;
+		}
+		batch->next_row++;
+		pthread_mutex_unlock(&(batch->lock));
+
+		lines = (worker_fields(worker, row) < 0) ? NULL : template_render(&(worker->cfg), &length);
+
+		pthread_mutex_lock(&(batch->lock));
+		batch->queue[row % BATCH_QUEUE_LENGTH].lines = lines;
+		batch->queue[row % BATCH_QUEUE_LENGTH].length = length;
+		batch->queue[row % BATCH_QUEUE_LENGTH].failed = !lines;
+		batch->queue[row % BATCH_QUEUE_LENGTH].ready = true;
+		pthread_cond_broadcast(&(batch->rendered));
+	}
+	pthread_mutex_unlock(&(batch->lock));
+	return NULL;
+}
+
+static int batch_start(CONF* cfg, TEMPLATE* template){
+	BATCH* batch = calloc(1, sizeof(BATCH));
+	unsigned u;
+	size_t e;
+	bool text = false;
+
+	if(!batch){
+		debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+		return -1;
+	}
+	cfg->batch = batch;
+	pthread_mutex_init(&(batch->lock), NULL);
+	pthread_cond_init(&(batch->rendered), NULL);
+	pthread_cond_init(&(batch->consumed), NULL);
+
+	//the field values reference the input data, which is kept until the batch is done
+	if(cfg->text){
+		debug(cfg->logger, LOG_ERROR, "CSV batches are read from the input\n");
+		return -1;
+	}
+	batch->data = input_text(cfg);
+	if(!batch->data || batch_parse(cfg, batch, batch->data) < 0){
+		return -1;
+	}
+
+	if(!batch->rows){
+		debug(cfg->logger, LOG_ERROR, "CSV input contains no labels\n");
+		return -1;
+	}
+
+	batch->workers = cfg->workers ? cfg->workers : sysconf(_SC_NPROCESSORS_ONLN);
+	batch->workers = (batch->workers < 1) ? 1 : batch->workers;
+	batch->worker = calloc(batch->workers, sizeof(BATCH_WORKER));
+	if(!batch->worker){
+		debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+		return -1;
+	}
+
+	for(e = 0; e < template->elements; e++){
+		text |= template->element[e].variable && template->element[e].type == ELEMENT_TEXT;
+	}
+
+	//the font is resolved once by the job renderer, the workers only open it
+	if(text && !cfg->renderer.resolved && !text_renderer_font(&(cfg->renderer))){
+		debug(cfg->logger, LOG_ERROR, "Failed to open font %s\n", cfg->renderer.fontspec);
+		return -1;
+	}
+
+	debug(cfg->logger, LOG_INFO, "Rendering %zu labels with %u workers\n", batch->rows, batch->workers);
+	for(u = 0; u < batch->workers; u++){
+		batch->worker[u].batch = batch;
+		batch->worker[u].cfg = *cfg;
+		batch->worker[u].cfg.renderer = text_renderer_share(&(cfg->renderer));
+		batch->worker[u].cfg.template = *template;
+		batch->worker[u].cfg.template.fields = 0;
+		batch->worker[u].cfg.template.field = NULL;
+
+		//fonts are opened before starting the workers
+		if(text && !text_renderer_font(&(batch->worker[u].cfg.renderer))){
+			debug(cfg->logger, LOG_ERROR, "Failed to open font %s\n", cfg->renderer.fontspec);
+			return -1;
+		}
+
+		if(pthread_create(&(batch->worker[u].thread), NULL, batch_worker, batch->worker + u)){
+			debug(cfg->logger, LOG_ERROR, "Failed to start batch worker\n");
+			return -1;
+		}
+		batch->worker[u].started = true;
+	}
+	return 0;
+}
+
+//fetch the next label in input order, returns 1 if more labels follow
+//the workers share the elements and static layer of the prepared template, which must not change until batch_free
+int batch_next(CONF* cfg, TEMPLATE* template, uint64_t** lines, size_t* length){
+	BATCH* batch = cfg->batch;
+	BATCH_LABEL* label;
+	bool failed;
+
+	if(!batch && batch_start(cfg, template) < 0){
+		return -1;
+	}
+	batch = cfg->batch;
+
+	pthread_mutex_lock(&(batch->lock));
+	label = batch->queue + (batch->next_print % BATCH_QUEUE_LENGTH);
+	while(!label->ready){
+		pthread_cond_wait(&(batch->rendered), &(batch->lock));
+	}
+	*lines = label->lines;
+	*length = label->length;
+	failed = label->failed;
+	label->ready = false;
+	label->lines = NULL;
+	batch->next_print++;
+	pthread_cond_broadcast(&(batch->consumed));
+	pthread_mutex_unlock(&(batch->lock));
+
+	if(failed){
+		debug(cfg->logger, LOG_ERROR, "Failed to render CSV row %zu\n", batch->next_print);
+		return -1;
+	}
+	return (batch->next_print < batch->rows) ? 1 : 0;
+}
+
+void batch_free(CONF* cfg){
+	BATCH* batch = cfg->batch;
+	size_t u;
+
+	if(!batch){
+		return;
+	}
+
+	pthread_mutex_lock(&(batch->lock));
+	batch->abort = true;
+	pthread_cond_broadcast(&(batch->consumed));
+	pthread_mutex_unlock(&(batch->lock));
+
+	for(u = 0; batch->worker && u < batch->workers; u++){
+		if(batch->worker[u].started){
+			pthread_join(batch->worker[u].thread, NULL);
+		}
+		template_clear_fields(&(batch->worker[u].cfg.template));
+		text_renderer_free(&(batch->worker[u].cfg.renderer));
+	}
+	for(u = 0; u < BATCH_QUEUE_LENGTH; u++){
+		free(batch->queue[u].lines);
+	}
+	for(u = 0; u < batch->rows; u++){
+		free(batch->values[u]);
+	}
+	free(batch->values);
+	free(batch->names);
+	free(batch->worker);
+	free(batch->data);
+
+	pthread_mutex_destroy(&(batch->lock));
+	pthread_cond_destroy(&(batch->rendered));
+	pthread_cond_destroy(&(batch->consumed));
+	free(batch);
+	cfg->batch = NULL;
+}
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * Benchmark runner
+ * Runs a command with generated input, counts its output and reports
+ * run time, throughput, system calls and peak memory usage as one
+ * JSON record per run.
+ */
+
+typedef enum /*_BENCH_INPUT*/ {
+	INPUT_NONE = 0,
+	INPUT_FILE,
+	INPUT_BITMAP,
+	INPUT_LINEMAP
+} BENCH_INPUT;
+
+typedef struct /*_BENCH_CONF*/ {
+	char* name;
+	BENCH_INPUT input;
+	char* file;
+	uint64_t count;
+	bool syscalls;
+	char** command;
+} BENCH_CONF;
+
+typedef struct /*_BENCH_RESULT*/ {
+	uint64_t input[2];	//bytes, lines
+	uint64_t output[3];	//bytes, lines, time of first byte
+	double seconds;
+	double first_byte;
+	long max_rss;
+	uint64_t syscalls;
+	int status;
+} BENCH_RESULT;
+
+int usage(char* fn){
+	fprintf(stderr, "bench - measure tool throughput\n");
+	fprintf(stderr, "Usage: %s [<options>] -- <command> [<arguments>]\n", fn);
+	fprintf(stderr, "Recognized options:\n");
+	fprintf(stderr, "\t--name <name>\t\tName of the benchmark\n");
+	fprintf(stderr, "\t--bitmap <lines>\tGenerate ASCII bitmap input\n");
+	fprintf(stderr, "\t--linemap <bars>\tGenerate linemap input\n");
+	fprintf(stderr, "\t--file <file>\t\tUse file contents as input\n");
+	fprintf(stderr, "\t--syscalls\t\tCount system calls in a second, traced run\n");
+	return EXIT_FAILURE;
+}
+
+static double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_all(int fd, size_t length, char* data){
+	ssize_t bytes;
+	size_t offset;
+
+	for(offset = 0; offset < length; offset += bytes){
+		bytes = write(fd, data + offset, length - offset);
+		if(bytes < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//produce the input stream, reporting the amount of data through the result pipe
+static void generate(BENCH_CONF* cfg, int fd, int result){
+	char buffer[65536];
+	uint64_t counts[2] = {0, 0}, u, state = 0x2545F4914F6CDD1DULL;
+	size_t fill = 0, b;
+	ssize_t bytes;
+	int file;
+
+	switch(cfg->input){
+		case INPUT_NONE:
+			break;
+		case INPUT_FILE:
+			file = open(cfg->file, O_RDONLY);
+			if(file < 0){
+				fprintf(stderr, "Failed to open %s\n", cfg->file);
+				break;
+			}
+			while((bytes = read(file, buffer, sizeof(buffer))) > 0){
+				for(b = 0; b < bytes; b++){
+					counts[1] += (buffer[b] == '\n');
+				}
+				counts[0] += bytes;
+				if(write_all(fd, bytes, buffer) < 0){
+					break;
+				}
+			}
+			close(file);
+			break;
+		case INPUT_BITMAP:
+		case INPUT_LINEMAP:
+			//xorshift noise, the worst case for the raster encoder
+			for(u = 0; u < cfg->count; u++){
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				if(cfg->input == INPUT_LINEMAP){
+					buffer[fill++] = '0' + (state & 1);
+				}
+				else{
+					for(b = 0; b < 64; b++){
+						buffer[fill++] = '0' + ((state >> b) & 1);
+					}
+					buffer[fill++] = '\n';
+					counts[1]++;
+				}
+
+				if(fill > sizeof(buffer) - 65){
+					if(write_all(fd, fill, buffer) < 0){
+						break;
+					}
+					counts[0] += fill;
+					fill = 0;
+				}
+			}
+			if(cfg->input == INPUT_LINEMAP){
+				buffer[fill++] = '\n';
+				counts[1] = cfg->count;
+			}
+			if(write_all(fd, fill, buffer) == 0){
+				counts[0] += fill;
+			}
+			break;
+	}
+
+	close(fd);
+	write_all(result, sizeof(counts), (char*)counts);
+	close(result);
+}
+
+//consume the output stream, noting when the first data arrived
+static void count_output(int fd, int result){
+	char buffer[65536];
+	uint64_t counts[3] = {0, 0, 0};
+	ssize_t bytes, b;
+
+	while((bytes = read(fd, buffer, sizeof(buffer))) > 0){
+		if(!counts[0]){
+			counts[2] = now() * 1e9;
+		}
+		for(b = 0; b < bytes; b++){
+			counts[1] += (buffer[b] == '\n');
+		}
+		counts[0] += bytes;
+	}
+
+	close(fd);
+	write_all(result, sizeof(counts), (char*)counts);
+	close(result);
+}
+
+static pid_t spawn_helper(BENCH_CONF* cfg, int data, int result, int* close_fds, bool generator){
+	pid_t pid = fork();
+	unsigned u;
+
+	if(pid == 0){
+		for(u = 0; close_fds[u] >= 0; u++){
+			close(close_fds[u]);
+		}
+		if(generator){
+			generate(cfg, data, result);
+		}
+		else{
+			count_output(data, result);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+	return pid;
+}
+
+static int run(BENCH_CONF* cfg, bool trace, BENCH_RESULT* result){
+	int input[2], output[2], input_result[2], output_result[2], status, null;
+	pid_t child, generator, counter, tracee;
+	struct rusage usage;
+	double start;
+
+	if(pipe(input) || pipe(output) || pipe(input_result) || pipe(output_result)){
+		fprintf(stderr, "Failed to create pipes\n");
+		return -1;
+	}
+
+	int generator_close[] = {input[0], output[0], output[1], input_result[0], output_result[0], output_result[1], -1};
+	int counter_close[] = {input[0], input[1], output[1], input_result[0], input_result[1], output_result[0], -1};
+
+	start = now();
+	generator = spawn_helper(cfg, input[1], input_result[1], generator_close, true);
+	counter = spawn_helper(cfg, output[0], output_result[1], counter_close, false);
+
+	child = fork();
+	if(child == 0){
+		null = open("/dev/null", O_WRONLY);
+		dup2(input[0], 0);
+		dup2(output[1], 1);
+		dup2(null, 2);
+		close(input[0]);
+		close(input[1]);
+		close(output[0]);
+		close(output[1]);
+		close(input_result[0]);
+		close(input_result[1]);
+		close(output_result[0]);
+		close(output_result[1]);
+		if(trace){
+			ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+		}
+		execvp(cfg->command[0], cfg->command);
+		_exit(127);
+	}
+
+	close(input[0]);
+	close(input[1]);
+	close(output[0]);
+	close(output[1]);
+	close(input_result[1]);
+	close(output_result[1]);
+
+	result->syscalls = 0;
+	if(trace){
+		//stopped at exec, threads cloned by the command are traced as well
+		waitpid(child, &status, 0);
+		ptrace(PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL | PTRACE_O_TRACECLONE);
+		ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+		while((tracee = waitpid(-1, &status, __WALL)) >= 0){
+			//the stream helpers are children as well, but not traced
+			if(tracee == generator || tracee == counter){
+				generator = (tracee == generator) ? -1 : generator;
+				counter = (tracee == counter) ? -1 : counter;
+				continue;
+			}
+
+			if(WIFEXITED(status) || WIFSIGNALED(status)){
+				if(tracee == child){
+					break;
+				}
+				continue;
+			}
+
+			//every system call stops the tracee on entry and exit, new threads start stopped
+			if(WSTOPSIG(status) == (SIGTRAP | 0x80)){
+				result->syscalls++;
+			}
+			ptrace(PTRACE_SYSCALL, tracee, NULL, NULL);
+		}
+		result->syscalls /= 2;
+	}
+	else{
+		wait4(child, &status, 0, &usage);
+		result->seconds = now() - start;
+		result->max_rss = usage.ru_maxrss;
+		result->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	}
+
+	if(read(input_result[0], result->input, sizeof(result->input)) != sizeof(result->input)
+			|| read(output_result[0], result->output, sizeof(result->output)) != sizeof(result->output)){
+		fprintf(stderr, "Failed to collect stream statistics\n");
+	}
+	close(input_result[0]);
+	close(output_result[0]);
+	result->first_byte = result->output[2] ? (result->output[2] / 1e9) - start : -1;
+	if(generator > 0){
+		waitpid(generator, NULL, 0);
+	}
+	if(counter > 0){
+		waitpid(counter, NULL, 0);
+	}
+	return 0;
+}
+
+int main(int argc, char** argv){
+	BENCH_CONF cfg = {
+		.name = "unnamed",
+		.input = INPUT_NONE,
+		.file = NULL,
+		.count = 0,
+		.syscalls = false,
+		.command = NULL
+	};
+	BENCH_RESULT result = {
+		.syscalls = 0
+	};
+	uint64_t lines, bytes;
+	int i;
+
+	for(i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "--")){
+			cfg.command = argv + i + 1;
+			break;
+		}
+		else if(!strcmp(argv[i], "--syscalls")){
+			cfg.syscalls = true;
+		}
+		else if(i + 1 >= argc){
+			exit(usage(argv[0]));
+		}
+		else if(!strcmp(argv[i], "--name")){
+			cfg.name = argv[++i];
+		}
+		else if(!strcmp(argv[i], "--bitmap")){
+			cfg.input = INPUT_BITMAP;
+			cfg.count = strtoull(argv[++i], NULL, 10);
+		}
+		else if(!strcmp(argv[i], "--linemap")){
+			cfg.input = INPUT_LINEMAP;
+			cfg.count = strtoull(argv[++i], NULL, 10);
+		}
+		else if(!strcmp(argv[i], "--file")){
+			cfg.input = INPUT_FILE;
+			cfg.file = argv[++i];
+		}
+		else{
+			exit(usage(argv[0]));
+		}
+	}
+
+	if(!cfg.command || !cfg.command[0]){
+		exit(usage(argv[0]));
+	}
+
+	if(run(&cfg, false, &result) < 0){
+		return EXIT_FAILURE;
+	}
+
+	if(cfg.syscalls){
+		BENCH_RESULT traced;
+		if(run(&cfg, true, &traced) < 0){
+			return EXIT_FAILURE;
+		}
+		result.syscalls = traced.syscalls;
+	}
+
+	//throughput is measured on the larger side of the stream
+	lines = (result.input[1] > result.output[1]) ? result.input[1] : result.output[1];
+	bytes = (result.input[0] > result.output[0]) ? result.input[0] : result.output[0];
+
+	printf("{\"name\": \"%s\", \"status\": %d, \"seconds\": %.6f, "
+			"\"input_bytes\": %" PRIu64 ", \"input_lines\": %" PRIu64 ", "
+			"\"output_bytes\": %" PRIu64 ", \"output_lines\": %" PRIu64 ", "
+			"\"lines_per_s\": %.1f, \"bytes_per_s\": %.1f, ",
+			cfg.name, result.status, result.seconds,
+			result.input[0], result.input[1], result.output[0], result.output[1],
+			lines / result.seconds, bytes / result.seconds);
+	if(cfg.syscalls){
+		printf("\"syscalls\": %" PRIu64 ", ", result.syscalls);
+	}
+	else{
+		printf("\"syscalls\": null, ");
+	}
+	//time to first byte only applies to commands producing output
+	if(result.first_byte >= 0){
+		printf("\"first_byte_s\": %.6f, ", result.first_byte);
+	}
+	else{
+		printf("\"first_byte_s\": null, ");
+	}
+	printf("\"max_rss_kb\": %ld}\n", result.max_rss);
+	return (result.status == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
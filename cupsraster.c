@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "textrender.h"
+#include "pt1230.h"
+
+/*
+ * CUPS raster input
+ * Streams (application/vnd.cups-raster) start with a sync word selecting the format version
+ * and byte order, followed by one page header and the page data per page. Every page is
+ * printed as one label, one raster row per raster line, so the label length follows the
+ * page size. Only single-channel data with 1 or 8 bits per pixel is accepted.
+ */
+
+#define CUPS_HEADER_V1_LENGTH	420
+#define CUPS_HEADER_LENGTH	1796
+
+//offsets of the fields in the page header
+#define CUPS_MIRROR_PRINT	332
+#define CUPS_NEGATIVE_PRINT	336
+#define CUPS_WIDTH		372
+#define CUPS_HEIGHT		376
+#define CUPS_BITS_PER_COLOR	384
+#define CUPS_BITS_PER_PIXEL	388
+#define CUPS_BYTES_PER_LINE	392
+#define CUPS_COLOR_ORDER	396
+#define CUPS_COLOR_SPACE	400
+
+//color spaces where 0 is black
+#define CUPS_CSPACE_W		0
+#define CUPS_CSPACE_SW		18
+//color spaces where 0 is white
+#define CUPS_CSPACE_K		3
+
+typedef struct /*_CUPS_PAGE*/ {
+	unsigned width;
+	unsigned height;
+	unsigned bits;
+	unsigned bytes_per_line;
+	bool white_zero;
+	bool negative;
+} CUPS_PAGE;
+
+static int cups_sync(CONF* cfg){
+	static const struct {
+		char sync[5];
+		unsigned version;
+		bool big_endian;
+	} sync_words[] = {
+		{"RaSt", 1, true}, {"tSaR", 1, false},
+		{"RaS2", 2, true}, {"2SaR", 2, false},
+		{"RaS3", 3, true}, {"3SaR", 3, false}
+	};
+	char sync[4];
+	size_t u;
+
+	if(input_read(cfg->logger, &(cfg->input), sizeof(sync), (uint8_t*)sync) != sizeof(sync)){
+		return -1;
+	}
+
+	for(u = 0; u < sizeof(sync_words) / sizeof(sync_words[0]); u++){
+		if(!memcmp(sync, sync_words[u].sync, sizeof(sync))){
+			cfg->raster.version = sync_words[u].version;
+			cfg->raster.big_endian = sync_words[u].big_endian;
+			debug(cfg->logger, LOG_INFO, "Detected CUPS raster v%u input\n", cfg->raster.version);
+			return 0;
+		}
+	}
+	debug(cfg->logger, LOG_ERROR, "Invalid CUPS raster sync word\n");
+	return -1;
+}
+
+//integers are stored in the byte order of the producing host, as indicated by the sync word
+static unsigned cups_field(CONF* cfg, uint8_t* header, size_t offset){
+	if(cfg->raster.big_endian){
+		return ((unsigned)header[offset] << 24) | (header[offset + 1] << 16) | (header[offset + 2] << 8) | header[offset + 3];
+	}
+	return ((unsigned)header[offset + 3] << 24) | (header[offset + 2] << 16) | (header[offset + 1] << 8) | header[offset];
+}
+
+static int cups_page_header(CONF* cfg, CUPS_PAGE* page){
+	uint8_t header[CUPS_HEADER_LENGTH];
+	size_t length = (cfg->raster.version == 1) ? CUPS_HEADER_V1_LENGTH : CUPS_HEADER_LENGTH;
+	unsigned space;
+
+	if(input_read(cfg->logger, &(cfg->input), length, header) != length){
+		debug(cfg->logger, LOG_ERROR, "CUPS raster page header ended prematurely\n");
+		return -1;
+	}
+
+	page->width = cups_field(cfg, header, CUPS_WIDTH);
+	page->height = cups_field(cfg, header, CUPS_HEIGHT);
+	page->bits = cups_field(cfg, header, CUPS_BITS_PER_PIXEL);
+	page->bytes_per_line = cups_field(cfg, header, CUPS_BYTES_PER_LINE);
+	page->negative = cups_field(cfg, header, CUPS_NEGATIVE_PRINT);
+	space = cups_field(cfg, header, CUPS_COLOR_SPACE);
+	page->white_zero = (space != CUPS_CSPACE_W && space != CUPS_CSPACE_SW);
+
+	if((page->bits != 1 && page->bits != 8)
+			|| page->bits != cups_field(cfg, header, CUPS_BITS_PER_COLOR)
+			|| cups_field(cfg, header, CUPS_COLOR_ORDER)
+			|| (space != CUPS_CSPACE_W && space != CUPS_CSPACE_SW && space != CUPS_CSPACE_K)){
+		debug(cfg->logger, LOG_ERROR, "Unsupported CUPS raster format (%u bits per pixel, color space %u), "
+				"only 1 or 8 bit single channel data is supported\n", page->bits, space);
+		return -1;
+	}
+
+	if(!page->width || page->bytes_per_line < (page->width * page->bits + 7) / 8 || page->bytes_per_line > CUPS_MAX_LINE_LENGTH){
+		debug(cfg->logger, LOG_ERROR, "Invalid CUPS raster geometry (%u pixels, %u bytes per line)\n", page->width, page->bytes_per_line);
+		return -1;
+	}
+
+	if(page->width > 64){
+		debug(cfg->logger, LOG_WARNING, "CUPS raster width %u exceeds printable width, truncating\n", page->width);
+	}
+	if(cups_field(cfg, header, CUPS_MIRROR_PRINT)){
+		debug(cfg->logger, LOG_WARNING, "Mirrored printing is not supported, ignoring\n");
+	}
+	debug(cfg->logger, LOG_INFO, "Reading %ux%u CUPS raster page (%u bits per pixel)\n", page->width, page->height, page->bits);
+	return 0;
+}
+
+//decode one row of a compressed (version 2) page, returns the number of times the row repeats
+static ssize_t cups_decode_row(CONF* cfg, CUPS_PAGE* page, uint8_t* row){
+	size_t pixel = (page->bits + 7) / 8, offset = 0, count;
+	int repeat = input_getc(cfg->logger, &(cfg->input)), c;
+
+	if(repeat == EOF){
+		return -1;
+	}
+
+	while(offset < page->bytes_per_line){
+		c = input_getc(cfg->logger, &(cfg->input));
+		if(c == EOF){
+			return -1;
+		}
+
+		//clear to the end of the line
+		if(c == 128){
+			memset(row + offset, page->white_zero ? 0x00 : 0xFF, page->bytes_per_line - offset);
+			break;
+		}
+
+		if(c < 128){
+			//repeated pixel
+			count = (c + 1) * pixel;
+			count = (count > page->bytes_per_line - offset) ? page->bytes_per_line - offset : count;
+			if(input_read(cfg->logger, &(cfg->input), pixel, row + offset) != pixel){
+				return -1;
+			}
+			memset(row + offset, row[offset], count);
+		}
+		else{
+			//literal pixels
+			count = (257 - c) * pixel;
+			count = (count > page->bytes_per_line - offset) ? page->bytes_per_line - offset : count;
+			if(input_read(cfg->logger, &(cfg->input), count, row + offset) != count){
+				return -1;
+			}
+		}
+		offset += count;
+	}
+	return repeat + 1;
+}
+
+//pack the first 64 pixels of a row, pixel n of the row is stored in bit n
+static uint64_t cups_pixels(CUPS_PAGE* page, uint8_t* row){
+	uint64_t pixels = 0;
+	unsigned u, width = (page->width < 64) ? page->width : 64;
+	bool black;
+
+	for(u = 0; u < width; u++){
+		if(page->bits == 1){
+			black = (row[u / 8] >> (7 - (u % 8))) & 1;
+		}
+		else{
+			black = row[u] >= 128;
+		}
+		black = (black == page->white_zero);
+		if(black != page->negative){
+			pixels |= 1ULL << u;
+		}
+	}
+	return pixels;
+}
+
+int process_cups(CONF* cfg){
+	CUPS_PAGE page;
+	uint8_t* row;
+	uint8_t line_buffer[8];
+	uint64_t pixels;
+	size_t line = 0;
+	ssize_t repeat;
+	unsigned u;
+	int rv = 0;
+
+	if(!cfg->raster.version && cups_sync(cfg) < 0){
+		return -1;
+	}
+
+	if(cups_page_header(cfg, &page) < 0){
+		return -1;
+	}
+
+	row = calloc(page.bytes_per_line, 1);
+	if(!row){
+		debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+		return -1;
+	}
+
+	//page data is streamed row by row
+	while(line < page.height){
+		if(cfg->raster.version == 2){
+			repeat = cups_decode_row(cfg, &page, row);
+		}
+		else{
+			repeat = (input_read(cfg->logger, &(cfg->input), page.bytes_per_line, row) == page.bytes_per_line) ? 1 : -1;
+		}
+
+		if(repeat < 0){
+			debug(cfg->logger, LOG_ERROR, "CUPS raster page data ended prematurely after %zu lines\n", line);
+			rv = -1;
+			break;
+		}
+
+		pixels = cups_pixels(&page, row);
+		for(u = 0; u < 8; u++){
+			line_buffer[u] = pixels >> (8 * (7 - u));
+		}
+
+		for(; repeat > 0 && line < page.height; repeat--, line++){
+			if(send_rasterline(cfg->logger, &(cfg->device), line_buffer, (page.width < 64) ? page.width : 64) < 0){
+				rv = -1;
+				break;
+			}
+		}
+		if(rv < 0){
+			break;
+		}
+	}
+	free(row);
+
+	if(rv < 0){
+		return -1;
+	}
+
+	//further pages follow immediately without another sync word
+	if(input_peek(cfg->logger, &(cfg->input), 1) < 0){
+		return -1;
+	}
+	return (cfg->input.length > cfg->input.offset) ? 1 : 0;
+}
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "textrender.h"
+#include "pt1230.h"
+
+/*
+ * Jobs are submitted over a local stream socket as a single header line
+ * (mode followed by optional flags), followed by the image data up to the
+ * end of the stream. The daemon answers each job with a single line
+ * containing the result and the status, error1 and error2 fields of the
+ * last status report received from the printer, eg.
+ *	Client=>Daemon | bitmap compress marker\n<image data><EOF>
+ * Linemap bar geometry is passed as bar-width=, bar-height= and bar-offset= flags.
+ * Template jobs pass the absolute template path as template= flag and the fields as data,
+ * the csv flag marks the fields as a CSV batch.
+ * Jobs requiring a specific media width carry it as media= flag (in mm).
+ *	Daemon=>Client | OK 01 00 00\n
+ */
+
+static char* mode_names[] = {
+	[MODE_QUERY] = "query",
+	[MODE_BITMAP] = "bitmap",
+	[MODE_LINEMAP] = "linemap",
+	[MODE_PACKED] = "packed",
+	[MODE_TEXT] = "text",
+	[MODE_BARCODE] = "barcode",
+	[MODE_TEMPLATE] = "template"
+};
+
+static int parse_job_header(CONF* cfg, char* header){
+	char* save = NULL;
+	char* token = strtok_r(header, " \t\r", &save);
+	unsigned u, media;
+
+	if(!token){
+		return -1;
+	}
+
+	cfg->mode = MODE_QUERY;
+	for(u = MODE_BITMAP; u < sizeof(mode_names) / sizeof(mode_names[0]); u++){
+		if(!strcmp(token, mode_names[u])){
+			cfg->mode = u;
+		}
+	}
+	if(cfg->mode == MODE_QUERY){
+		debug(cfg->logger, LOG_WARNING, "Unknown job mode %s\n", token);
+		return -1;
+	}
+
+	cfg->chain_print = false;
+	cfg->print_marker = false;
+	cfg->device.compress = false;
+	cfg->csv = false;
+	cfg->bars.width = 0;
+	cfg->bars.height = 0;
+	cfg->bars.offset = 0;
+	for(token = strtok_r(NULL, " \t\r", &save); token; token = strtok_r(NULL, " \t\r", &save)){
+		if(!strcmp(token, "chain")){
+			cfg->chain_print = true;
+		}
+		else if(!strcmp(token, "marker")){
+			cfg->print_marker = true;
+		}
+		else if(!strcmp(token, "compress")){
+			cfg->device.compress = true;
+		}
+		else if(!strcmp(token, "csv")){
+			cfg->csv = true;
+		}
+		else if(!strncmp(token, "symbology=", 10)){
+			if(barcode_symbology(token + 10) < 0){
+				debug(cfg->logger, LOG_WARNING, "Unknown barcode symbology %s\n", token + 10);
+				return -1;
+			}
+			cfg->symbology = barcode_symbology(token + 10);
+		}
+		else if(!strncmp(token, "template=", 9)){
+			if(strlen(token + 9) >= sizeof(cfg->template.path)){
+				debug(cfg->logger, LOG_WARNING, "Template path too long\n");
+				return -1;
+			}
+			//the static layer of the previous template is reused for the same path
+			if(strcmp(cfg->template.path, token + 9)){
+				template_free(&(cfg->template));
+				strncpy(cfg->template.path, token + 9, sizeof(cfg->template.path) - 1);
+			}
+		}
+		else if(!strncmp(token, "media=", 6)){
+			media = strtoul(token + 6, NULL, 10);
+			if(media != (cfg->media_width ? cfg->media_width : cfg->device.status.media_width)){
+				debug(cfg->logger, LOG_WARNING, "Job requires %umm media, loaded media is %umm\n", media,
+						cfg->media_width ? cfg->media_width : cfg->device.status.media_width);
+				return -1;
+			}
+		}
+		else if(!strncmp(token, "bar-width=", 10)){
+			cfg->bars.width = strtoul(token + 10, NULL, 10);
+		}
+		else if(!strncmp(token, "bar-height=", 11)){
+			cfg->bars.height = strtoul(token + 11, NULL, 10);
+		}
+		else if(!strncmp(token, "bar-offset=", 11)){
+			cfg->bars.offset = strtoul(token + 11, NULL, 10);
+		}
+		else{
+			debug(cfg->logger, LOG_WARNING, "Unknown job flag %s\n", token);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//read the header line of a job, the input buffer may already hold the start of the job data
+int daemon_job_header(CONF* cfg, int client, size_t length, char* header){
+	struct timeval timeout = {
+		.tv_sec = DAEMON_HEADER_TIMEOUT / 1000,
+		.tv_usec = (DAEMON_HEADER_TIMEOUT % 1000) * 1000
+	};
+	size_t offset = 0;
+	int c;
+
+	cfg->input.fd = client;
+	cfg->input.offset = 0;
+	cfg->input.length = 0;
+	cfg->input.failed = false;
+	cfg->input.eof = false;
+
+	//clients get a limited amount of time to send their header
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	for(c = input_getc(cfg->logger, &(cfg->input)); c != EOF && c != '\n'; c = input_getc(cfg->logger, &(cfg->input))){
+		if(offset >= length - 1){
+			return -1;
+		}
+		header[offset++] = c;
+	}
+	header[offset] = 0;
+
+	//stalled clients fail their job instead of blocking the daemon or a spooler printer
+	timeout.tv_sec = DAEMON_DATA_TIMEOUT / 1000;
+	timeout.tv_usec = (DAEMON_DATA_TIMEOUT % 1000) * 1000;
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	return (c == '\n') ? 0 : -1;
+}
+
+//print a job whose header was read into the input of the configuration and report the result to the client
+int daemon_job_run(CONF* cfg, int client, char* header){
+	int rv = -1;
+
+	//reset per-job state
+	cfg->device.syscalls = 0;
+	cfg->device.raster_plain = 0;
+	cfg->device.raster_sent = 0;
+	cfg->device.cache_valid = false;
+	cfg->text = NULL;
+	cfg->raster.version = 0;
+
+	debug(cfg->logger, LOG_INFO, "Processing job: %s\n", header);
+	if(parse_job_header(cfg, header) < 0){
+		dprintf(client, "ERROR invalid job header\n");
+		return 0;
+	}
+
+	rv = print_job(cfg);
+	batch_free(cfg);
+	debug(cfg->logger, LOG_INFO, "Job %s, used %u device syscalls\n", (rv < 0) ? "failed" : "done", cfg->device.syscalls);
+	stats_report(cfg, rv);
+	dprintf(client, "%s %02X %02X %02X\n", (rv < 0) ? "ERROR" : "OK",
+			cfg->device.status.status, cfg->device.status.error1, cfg->device.status.error2);
+	return rv;
+}
+
+static int daemon_job(CONF* cfg, int client){
+	char header[DATA_BUFFER_LENGTH];
+
+	if(daemon_job_header(cfg, client, sizeof(header), header) < 0){
+		debug(cfg->logger, LOG_WARNING, "Failed to read job header\n");
+		dprintf(client, "ERROR invalid job header\n");
+		return 0;
+	}
+	return daemon_job_run(cfg, client, header);
+}
+
+//create the listening job socket
+int daemon_socket(CONF* cfg){
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX
+	};
+	int fd;
+
+	if(strlen(cfg->socket_path) >= sizeof(addr.sun_path)){
+		debug(cfg->logger, LOG_ERROR, "Socket path too long\n");
+		return -1;
+	}
+	strncpy(addr.sun_path, cfg->socket_path, sizeof(addr.sun_path) - 1);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(fd < 0){
+		debug(cfg->logger, LOG_ERROR, "daemon/socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	unlink(cfg->socket_path);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+			|| listen(fd, DAEMON_BACKLOG) < 0){
+		debug(cfg->logger, LOG_ERROR, "daemon/bind: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	//clients disconnecting early should not terminate the daemon
+	signal(SIGPIPE, SIG_IGN);
+	debug(cfg->logger, LOG_INFO, "Accepting jobs on %s\n", cfg->socket_path);
+	return fd;
+}
+
+int run_daemon(CONF* cfg){
+	char device_buffer[(DEVICE_BUFFER_LENGTH * sizeof(PROTO_STATUS))];
+	struct pollfd pfd = {
+		.events = POLLIN
+	};
+	int queue[DAEMON_QUEUE_LENGTH];
+	size_t head = 0, queued = 0;
+	int client;
+
+	pfd.fd = daemon_socket(cfg);
+	if(pfd.fd < 0){
+		return -1;
+	}
+
+	while(true){
+		//block only while there is nothing to do
+		if(!queued && poll(&pfd, 1, -1) < 0 && errno != EINTR){
+			debug(cfg->logger, LOG_ERROR, "daemon/poll: %s\n", strerror(errno));
+			break;
+		}
+
+		//queue all pending connections in order of arrival
+		while(queued < DAEMON_QUEUE_LENGTH){
+			client = accept(pfd.fd, NULL, NULL);
+			if(client < 0){
+				if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+					debug(cfg->logger, LOG_WARNING, "daemon/accept: %s\n", strerror(errno));
+				}
+				break;
+			}
+			queue[(head + queued) % DAEMON_QUEUE_LENGTH] = client;
+			queued++;
+		}
+
+		if(!queued){
+			continue;
+		}
+
+		client = queue[head];
+		head = (head + 1) % DAEMON_QUEUE_LENGTH;
+		queued--;
+		debug(cfg->logger, LOG_DEBUG, "Starting job, %zu more queued\n", queued);
+
+		if(daemon_job(cfg, client) < 0){
+			//discard partial data and bring the printer back into a known state
+			cfg->device.fill = 0;
+			debug(cfg->logger, LOG_INFO, "Reinitializing printer\n");
+			if(printer_init(cfg, sizeof(device_buffer), device_buffer) < 0){
+				close(client);
+				break;
+			}
+		}
+		close(client);
+	}
+
+	close(pfd.fd);
+	unlink(cfg->socket_path);
+	return -1;
+}
+
+//append to the job header, fails if the result does not fit the buffer
+static int header_append(char* buffer, size_t length, ssize_t* offset, char* fmt, ...){
+	va_list args;
+	int bytes;
+
+	va_start(args, fmt);
+	bytes = vsnprintf(buffer + *offset, length - *offset, fmt, args);
+	va_end(args);
+
+	if(bytes < 0 || bytes >= length - *offset){
+		return -1;
+	}
+	*offset += bytes;
+	return 0;
+}
+
+int submit_job(CONF* cfg){
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX
+	};
+	char buffer[DATA_BUFFER_LENGTH];
+	char template[PATH_MAX];
+	ssize_t bytes, offset, written;
+	int fd = -1;
+
+	if(cfg->mode == MODE_QUERY){
+		debug(cfg->logger, LOG_ERROR, "Status queries can not be submitted to the daemon\n");
+		return -1;
+	}
+
+	if(strlen(cfg->socket_path) >= sizeof(addr.sun_path)){
+		debug(cfg->logger, LOG_ERROR, "Socket path too long\n");
+		return -1;
+	}
+	strncpy(addr.sun_path, cfg->socket_path, sizeof(addr.sun_path) - 1);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+		debug(cfg->logger, LOG_ERROR, "Failed to connect to daemon at %s: %s\n", cfg->socket_path, strerror(errno));
+		if(fd >= 0){
+			close(fd);
+		}
+		return -1;
+	}
+
+	//the daemon resolves template paths from its own working directory
+	if(cfg->mode == MODE_TEMPLATE && !realpath(cfg->template.path, template)){
+		debug(cfg->logger, LOG_ERROR, "Failed to resolve template path %s\n", cfg->template.path);
+		close(fd);
+		return -1;
+	}
+
+	//the daemon does not accept longer template paths
+	if(cfg->mode == MODE_TEMPLATE && strlen(template) >= sizeof(cfg->template.path)){
+		debug(cfg->logger, LOG_ERROR, "Template path %s too long\n", template);
+		close(fd);
+		return -1;
+	}
+
+	debug(cfg->logger, LOG_INFO, "Submitting job to %s\n", cfg->socket_path);
+	bytes = 0;
+	if(header_append(buffer, sizeof(buffer), &bytes, "%s%s%s%s%s symbology=%s bar-width=%u bar-height=%u bar-offset=%u%s%s", mode_names[cfg->mode],
+				cfg->chain_print ? " chain" : "",
+				cfg->print_marker ? " marker" : "",
+				cfg->device.compress ? " compress" : "",
+				cfg->csv ? " csv" : "",
+				barcode_symbology_name(cfg->symbology),
+				cfg->bars.width, cfg->bars.height, cfg->bars.offset,
+				(cfg->mode == MODE_TEMPLATE) ? " template=" : "",
+				(cfg->mode == MODE_TEMPLATE) ? template : "") < 0
+			//a media width given on submission selects a printer with that media loaded
+			|| (cfg->media_width && header_append(buffer, sizeof(buffer), &bytes, " media=%u", cfg->media_width) < 0)
+			|| header_append(buffer, sizeof(buffer), &bytes, "\n") < 0){
+		debug(cfg->logger, LOG_ERROR, "Job header too long\n");
+		close(fd);
+		return -1;
+	}
+
+	//text or barcode data given on the command line is sent as job data
+	if(cfg->text && header_append(buffer, sizeof(buffer), &bytes, "%s", cfg->text) < 0){
+		debug(cfg->logger, LOG_ERROR, "Text too long for daemon submission\n");
+		close(fd);
+		return -1;
+	}
+
+	//send header followed by the image data
+	do{
+		for(offset = 0; offset < bytes; offset += written){
+			written = write(fd, buffer + offset, bytes - offset);
+			if(written < 0){
+				debug(cfg->logger, LOG_ERROR, "daemon/write: %s\n", strerror(errno));
+				close(fd);
+				return -1;
+			}
+		}
+		bytes = cfg->text ? 0 : read(cfg->input.fd, buffer, sizeof(buffer));
+	}
+	while(bytes > 0);
+
+	if(bytes < 0){
+		debug(cfg->logger, LOG_ERROR, "input/read: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	shutdown(fd, SHUT_WR);
+
+	//wait for the result
+	for(offset = 0; offset < sizeof(buffer) - 1; offset += bytes){
+		bytes = read(fd, buffer + offset, sizeof(buffer) - 1 - offset);
+		if(bytes <= 0){
+			break;
+		}
+	}
+	buffer[offset] = 0;
+	close(fd);
+
+	if(offset == 0){
+		debug(cfg->logger, LOG_ERROR, "Daemon closed connection without result\n");
+		return -1;
+	}
+
+	debug(cfg->logger, LOG_INFO, "Daemon reported: %s", buffer);
+	return strncmp(buffer, "OK", 2) ? -1 : 0;
+}
@@ -0,0 +1,485 @@
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+
+/*
+ * PT-1230PC emulator
+ * Presents a pseudo terminal which the interface can open as device node,
+ * parses the command stream, answers with status reports and dumps
+ * every printed label as PBM image.
+ */
+
+#define EMU_BUFFER_LENGTH 65536
+#define EMU_MAX_LINES 65536
+
+typedef struct /*_EMU_CONF*/ {
+	unsigned media_width;
+	unsigned long bandwidth;
+	unsigned long print_speed;
+	unsigned long fail_after;
+	unsigned long labels;
+	char* output;
+	bool verbose;
+} EMU_CONF;
+
+typedef struct /*_EMU_PAGE*/ {
+	size_t lines;
+	uint64_t data[EMU_MAX_LINES];
+} EMU_PAGE;
+
+typedef struct /*_EMU_STATE*/ {
+	int master;
+	bool raster;
+	bool compress;
+	bool failed;
+	uint8_t phase;
+	EMU_PAGE receiving;
+	EMU_PAGE printing;
+	EMU_PAGE queued;
+	bool print_active;
+	bool print_queued;
+	uint64_t print_done;
+	unsigned long labels;
+	unsigned long lines_total;
+	unsigned long bytes_label;
+	unsigned long bytes_total;
+	uint64_t label_start;
+} EMU_STATE;
+
+static volatile bool shutdown_requested = false;
+
+int usage(char* fn){
+	fprintf(stderr, "emulator - PT-1230PC printer emulator\n");
+	fprintf(stderr, "Usage: %s [<options>]\n", fn);
+	fprintf(stderr, "Recognized options:\n");
+	fprintf(stderr, "\t--width <mm>\t\tReported media width (default: 12)\n");
+	fprintf(stderr, "\t--bandwidth <bytes/s>\tSimulated transfer bandwidth (default: unlimited)\n");
+	fprintf(stderr, "\t--speed <lines/s>\tSimulated print speed (default: unlimited)\n");
+	fprintf(stderr, "\t--fail <lines>\t\tReport running out of tape after receiving this many raster lines\n");
+	fprintf(stderr, "\t--labels <count>\tExit after printing this many labels\n");
+	fprintf(stderr, "\t--output <prefix>\tDump printed labels to <prefix>-<n>.pbm\n");
+	fprintf(stderr, "\t--verbose\t\tLog every command\n");
+	return EXIT_FAILURE;
+}
+
+static void signal_handler(int signum){
+	shutdown_requested = true;
+}
+
+static uint64_t now_us(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+static void send_status(EMU_STATE* state, EMU_CONF* cfg, uint8_t type, uint8_t error1){
+	uint8_t status[32] = {0x80, 0x20, 'B', '0', 0x00, '0', 0x00, 0x00};
+
+	status[8] = error1;
+	status[10] = cfg->media_width;
+	status[11] = 0x01;
+	status[18] = type;
+	status[19] = state->phase;
+	status[22] = 0x00;
+
+	if(write(state->master, status, sizeof(status)) != sizeof(status)){
+		fprintf(stderr, "Failed to send status report: %s\n", strerror(errno));
+	}
+}
+
+static void dump_page(EMU_CONF* cfg, EMU_PAGE* page, unsigned long label){
+	char path[4096];
+	uint8_t row[8];
+	size_t line;
+	unsigned u, b;
+	FILE* file;
+
+	if(!cfg->output){
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%s-%lu.pbm", cfg->output, label);
+	file = fopen(path, "w");
+	if(!file){
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	//head pixel n is stored in bit n, PBM maps the leftmost pixel to the MSB
+	fprintf(file, "P4\n64 %zu\n", page->lines);
+	for(line = 0; line < page->lines; line++){
+		for(u = 0; u < 8; u++){
+			row[u] = 0;
+			for(b = 0; b < 8; b++){
+				if(page->data[line] & (1ULL << (8 * u + b))){
+					row[u] |= 0x80 >> b;
+				}
+			}
+		}
+		fwrite(row, 1, sizeof(row), file);
+	}
+	fclose(file);
+}
+
+static void copy_page(EMU_PAGE* target, EMU_PAGE* source){
+	target->lines = source->lines;
+	memcpy(target->data, source->data, source->lines * sizeof(uint64_t));
+	source->lines = 0;
+}
+
+static void start_print(EMU_STATE* state, EMU_CONF* cfg){
+	copy_page(&(state->printing), &(state->queued));
+	state->print_active = true;
+	state->print_queued = false;
+	state->phase = 0x01;
+	send_status(state, cfg, 0x06, 0x00);
+
+	state->print_done = now_us();
+	if(cfg->print_speed){
+		state->print_done += (state->printing.lines * 1000000ULL) / cfg->print_speed;
+	}
+}
+
+static void finish_print(EMU_STATE* state, EMU_CONF* cfg){
+	uint64_t elapsed = now_us() - state->label_start;
+
+	state->labels++;
+	dump_page(cfg, &(state->printing), state->labels);
+	fprintf(stderr, "Label %lu: %zu lines, %lu bytes received, %.3fs from first byte to completion\n",
+			state->labels, state->printing.lines, state->bytes_label, elapsed / 1e6);
+	state->bytes_label = 0;
+	state->label_start = 0;
+
+	state->print_active = false;
+	send_status(state, cfg, 0x01, 0x00);
+	state->phase = 0x00;
+	send_status(state, cfg, 0x06, 0x00);
+
+	if(cfg->labels && state->labels >= cfg->labels){
+		shutdown_requested = true;
+	}
+}
+
+static void print_page(EMU_STATE* state, EMU_CONF* cfg, bool feed){
+	if(cfg->verbose){
+		fprintf(stderr, "Print command (%s), %zu lines\n", feed ? "feed" : "chain", state->receiving.lines);
+	}
+
+	if(state->failed){
+		state->receiving.lines = 0;
+		send_status(state, cfg, 0x02, 0x01);
+		return;
+	}
+
+	if(state->print_queued){
+		fprintf(stderr, "Print command received before previous label completed, discarding\n");
+		state->receiving.lines = 0;
+		return;
+	}
+
+	copy_page(&(state->queued), &(state->receiving));
+	state->print_queued = true;
+	if(!state->print_active){
+		start_print(state, cfg);
+	}
+}
+
+static void add_line(EMU_STATE* state, EMU_CONF* cfg, uint64_t pixels){
+	if(state->failed){
+		return;
+	}
+
+	state->lines_total++;
+	if(cfg->fail_after && state->lines_total > cfg->fail_after){
+		fprintf(stderr, "Injecting media error after %lu lines\n", cfg->fail_after);
+		state->failed = true;
+		send_status(state, cfg, 0x02, 0x01);
+		return;
+	}
+
+	if(state->receiving.lines >= EMU_MAX_LINES){
+		fprintf(stderr, "Raster buffer overflow\n");
+		return;
+	}
+	state->receiving.data[state->receiving.lines++] = pixels;
+}
+
+//decode a raster line data section, the first 4 bytes are padding
+static uint64_t decode_line(size_t length, uint8_t* data){
+	uint64_t pixels = 0;
+	size_t u;
+
+	for(u = 4; u < length && u < 12; u++){
+		pixels |= ((uint64_t)data[u]) << (8 * (11 - u));
+	}
+	return pixels;
+}
+
+static size_t unpackbits(size_t length, uint8_t* data, size_t limit, uint8_t* out){
+	size_t i = 0, o = 0, run;
+
+	while(i < length){
+		if(data[i] < 128){
+			run = data[i] + 1;
+			if(i + 1 + run > length || o + run > limit){
+				return 0;
+			}
+			memcpy(out + o, data + i + 1, run);
+			i += run + 1;
+		}
+		else{
+			run = 257 - data[i];
+			if(i + 1 >= length || o + run > limit){
+				return 0;
+			}
+			memset(out + o, data[i + 1], run);
+			i += 2;
+		}
+		o += run;
+	}
+	return o;
+}
+
+//parse one command, returns the number of bytes consumed or 0 if the command is incomplete
+static size_t parse_command(EMU_STATE* state, EMU_CONF* cfg, size_t length, uint8_t* data){
+	uint8_t plain[256];
+	size_t payload;
+
+	switch(data[0]){
+		case 0x1B:
+			if(length < 2){
+				return 0;
+			}
+			if(data[1] == '@'){
+				if(cfg->verbose){
+					fprintf(stderr, "Initialize\n");
+				}
+				state->raster = false;
+				state->compress = false;
+				state->failed = false;
+				state->receiving.lines = 0;
+				return 2;
+			}
+			if(data[1] != 'i'){
+				break;
+			}
+			if(length < 3){
+				return 0;
+			}
+			if(data[2] == 'S'){
+				if(cfg->verbose){
+					fprintf(stderr, "Status request\n");
+				}
+				send_status(state, cfg, 0x00, state->failed ? 0x01 : 0x00);
+				return 3;
+			}
+			if(data[2] == 'R'){
+				if(length < 4){
+					return 0;
+				}
+				if(cfg->verbose){
+					fprintf(stderr, "Raster mode %02X\n", data[3]);
+				}
+				state->raster = (data[3] == 0x01);
+				return 4;
+			}
+			break;
+		case 'M':
+			if(length < 2){
+				return 0;
+			}
+			if(cfg->verbose){
+				fprintf(stderr, "Compression mode %02X\n", data[1]);
+			}
+			state->compress = (data[1] == 0x02);
+			return 2;
+		case 'G':
+			if(length < 3){
+				return 0;
+			}
+			payload = data[1] | (data[2] << 8);
+			if(length < 3 + payload){
+				return 0;
+			}
+			if(!state->raster){
+				fprintf(stderr, "Raster line outside of raster mode\n");
+			}
+			if(state->compress){
+				memset(plain, 0, sizeof(plain));
+				if(!unpackbits(payload, data + 3, sizeof(plain), plain)){
+					fprintf(stderr, "Invalid compressed raster line\n");
+				}
+				add_line(state, cfg, decode_line(sizeof(plain), plain));
+			}
+			else{
+				add_line(state, cfg, decode_line(payload, data + 3));
+			}
+			return 3 + payload;
+		case 'Z':
+			add_line(state, cfg, 0);
+			return 1;
+		case 0x0C:
+			print_page(state, cfg, false);
+			return 1;
+		case 0x1A:
+			print_page(state, cfg, true);
+			return 1;
+	}
+
+	fprintf(stderr, "Unknown command byte %02X\n", data[0]);
+	return 1;
+}
+
+int main(int argc, char** argv){
+	EMU_CONF cfg = {
+		.media_width = 12,
+		.bandwidth = 0,
+		.print_speed = 0,
+		.fail_after = 0,
+		.labels = 0,
+		.output = NULL,
+		.verbose = false
+	};
+	static EMU_STATE state;
+	static uint8_t buffer[EMU_BUFFER_LENGTH];
+	size_t fill = 0, offset, consumed, chunk;
+	uint64_t next_read = 0, now;
+	struct termios tio;
+	struct pollfd pfd;
+	ssize_t bytes;
+	int slave, timeout, i;
+
+	for(i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "--verbose")){
+			cfg.verbose = true;
+		}
+		else if(i + 1 >= argc){
+			exit(usage(argv[0]));
+		}
+		else if(!strcmp(argv[i], "--width")){
+			cfg.media_width = strtoul(argv[++i], NULL, 10);
+		}
+		else if(!strcmp(argv[i], "--bandwidth")){
+			cfg.bandwidth = strtoul(argv[++i], NULL, 10);
+		}
+		else if(!strcmp(argv[i], "--speed")){
+			cfg.print_speed = strtoul(argv[++i], NULL, 10);
+		}
+		else if(!strcmp(argv[i], "--fail")){
+			cfg.fail_after = strtoul(argv[++i], NULL, 10);
+		}
+		else if(!strcmp(argv[i], "--labels")){
+			cfg.labels = strtoul(argv[++i], NULL, 10);
+		}
+		else if(!strcmp(argv[i], "--output")){
+			cfg.output = argv[++i];
+		}
+		else{
+			exit(usage(argv[0]));
+		}
+	}
+
+	state.master = posix_openpt(O_RDWR | O_NOCTTY);
+	if(state.master < 0 || grantpt(state.master) || unlockpt(state.master)){
+		fprintf(stderr, "Failed to create pseudo terminal: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	//keep the slave side open and raw so the interface sees an unmodified byte stream
+	slave = open(ptsname(state.master), O_RDWR | O_NOCTTY);
+	if(slave < 0 || tcgetattr(slave, &tio)){
+		fprintf(stderr, "Failed to configure pseudo terminal: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	//the device node is the only thing printed to stdout
+	printf("%s\n", ptsname(state.master));
+	fflush(stdout);
+
+	pfd.fd = state.master;
+	pfd.events = POLLIN;
+
+	while(!shutdown_requested){
+		now = now_us();
+
+		//simulated printing finished
+		if(state.print_active && now >= state.print_done){
+			finish_print(&state, &cfg);
+			if(state.print_queued){
+				start_print(&state, &cfg);
+			}
+			continue;
+		}
+
+		timeout = -1;
+		if(state.print_active){
+			timeout = (state.print_done - now) / 1000 + 1;
+		}
+
+		//throttle reading to the simulated bandwidth
+		if(next_read > now){
+			timeout = (timeout < 0 || (next_read - now) / 1000 + 1 < timeout) ? (next_read - now) / 1000 + 1 : timeout;
+			poll(NULL, 0, timeout);
+			continue;
+		}
+
+		if(poll(&pfd, 1, timeout) <= 0){
+			continue;
+		}
+
+		chunk = sizeof(buffer) - fill;
+		if(cfg.bandwidth && chunk > cfg.bandwidth / 100 + 1){
+			chunk = cfg.bandwidth / 100 + 1;
+		}
+
+		bytes = read(state.master, buffer + fill, chunk);
+		if(bytes <= 0){
+			if(bytes < 0 && errno != EAGAIN && errno != EINTR){
+				fprintf(stderr, "Failed to read from pseudo terminal: %s\n", strerror(errno));
+				break;
+			}
+			continue;
+		}
+
+		if(!state.label_start){
+			state.label_start = now_us();
+		}
+		state.bytes_label += bytes;
+		state.bytes_total += bytes;
+		fill += bytes;
+		if(cfg.bandwidth){
+			next_read = now_us() + (bytes * 1000000ULL) / cfg.bandwidth;
+		}
+
+		//process all complete commands
+		for(offset = 0; offset < fill; offset += consumed){
+			consumed = parse_command(&state, &cfg, fill - offset, buffer + offset);
+			if(!consumed){
+				break;
+			}
+		}
+		memmove(buffer, buffer + offset, fill - offset);
+		fill -= offset;
+	}
+
+	fprintf(stderr, "Printed %lu labels, %lu raster lines, %lu bytes received\n", state.labels, state.lines_total, state.bytes_total);
+	close(slave);
+	close(state.master);
+	return EXIT_SUCCESS;
+}
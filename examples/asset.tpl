@@ -0,0 +1,7 @@
+# Asset label for 12mm tape, fields are read from the input as name=value lines
+length 480
+frame 0 0 480 64
+text 8 34 24 {name}
+barcode code128 0 6 24 {serial}
+text 250 20 24 ACME Facilities
+barcode qr 400 2 60 https://assets.example.com/{serial}
@@ -0,0 +1,633 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/types.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "textrender.h"
+#include "pt1230.h"
+
+/*
+ * 2D matrix symbol encoders
+ * Symbols are encoded into a square matrix of modules (1 for black, 0 for white),
+ * stored row by row starting at the top left. Quiet zones are not part of the matrix.
+ */
+
+#define QR_MAX_VERSION		10
+#define QR_FORMAT_MASK		0x5412
+#define QR_FORMAT_POLY		0x537
+#define QR_VERSION_POLY		0x1F25
+#define QR_GF_POLY		0x11D
+#define QR_PAD_A		0xEC
+#define QR_PAD_B		0x11
+#define DATAMATRIX_GF_POLY	0x12D
+#define DATAMATRIX_PAD		129
+#define DATAMATRIX_UPPER_SHIFT	235
+#define MATRIX_MAX_CODEWORDS	400
+#define MATRIX_MAX_ECC		32
+
+typedef struct /*_GALOIS*/ {
+	uint8_t exp[512];
+	uint8_t log[256];
+} GALOIS;
+
+//error correction level M, data codewords per block in the second group are one more than in the first
+typedef struct /*_QR_VERSION*/ {
+	unsigned ecc;
+	unsigned blocks[2];
+	unsigned data;
+	uint8_t alignment[3];
+} QR_VERSION;
+
+static QR_VERSION qr_versions[QR_MAX_VERSION + 1] = {
+	[1] = {10, {1, 0}, 16, {0}},
+	[2] = {16, {1, 0}, 28, {6, 18}},
+	[3] = {26, {1, 0}, 44, {6, 22}},
+	[4] = {18, {2, 0}, 32, {6, 26}},
+	[5] = {24, {2, 0}, 43, {6, 30}},
+	[6] = {16, {4, 0}, 27, {6, 34}},
+	[7] = {18, {4, 0}, 31, {6, 22, 38}},
+	[8] = {22, {2, 2}, 38, {6, 24, 42}},
+	[9] = {22, {3, 2}, 36, {6, 26, 46}},
+	[10] = {26, {4, 1}, 43, {6, 28, 50}}
+};
+
+//square ECC200 symbols with a single data region and a single error correction block
+typedef struct /*_DATAMATRIX_SIZE*/ {
+	unsigned size;
+	unsigned data;
+	unsigned ecc;
+} DATAMATRIX_SIZE;
+
+static DATAMATRIX_SIZE datamatrix_sizes[] = {
+	{10, 3, 5}, {12, 5, 7}, {14, 8, 10}, {16, 12, 12}, {18, 18, 14},
+	{20, 22, 18}, {22, 30, 20}, {24, 36, 24}, {26, 44, 28}
+};
+
+typedef struct /*_MATRIX*/ {
+	unsigned size;
+	uint8_t* modules;
+	uint8_t function[MATRIX_MAX_SIZE * MATRIX_MAX_SIZE];
+} MATRIX;
+
+static void galois_init(GALOIS* gf, unsigned poly){
+	unsigned u, x = 1;
+
+	for(u = 0; u < 255; u++){
+		gf->exp[u] = x;
+		gf->log[x] = u;
+		x <<= 1;
+		if(x & 0x100){
+			x ^= poly;
+		}
+	}
+	for(u = 255; u < sizeof(gf->exp); u++){
+		gf->exp[u] = gf->exp[u - 255];
+	}
+}
+
+static inline uint8_t galois_mul(GALOIS* gf, uint8_t a, uint8_t b){
+	return (a && b) ? gf->exp[gf->log[a] + gf->log[b]] : 0;
+}
+
+//reed-solomon error correction codewords, the generator roots start at alpha^first
+static void rs_encode(GALOIS* gf, unsigned first, uint8_t* data, size_t length, uint8_t* ecc, size_t ecc_length){
+	uint8_t generator[MATRIX_MAX_ECC + 1] = {1}, factor;
+	size_t u, v;
+
+	for(u = 0; u < ecc_length; u++){
+		generator[u + 1] = 0;
+		for(v = u + 1; v > 0; v--){
+			generator[v] ^= galois_mul(gf, generator[v - 1], gf->exp[u + first]);
+		}
+	}
+
+	memset(ecc, 0, ecc_length);
+	for(u = 0; u < length; u++){
+		factor = data[u] ^ ecc[0];
+		memmove(ecc, ecc + 1, ecc_length - 1);
+		ecc[ecc_length - 1] = 0;
+		for(v = 0; v < ecc_length; v++){
+			ecc[v] ^= galois_mul(gf, generator[v + 1], factor);
+		}
+	}
+}
+
+static inline void matrix_set(MATRIX* matrix, unsigned x, unsigned y, bool black, bool function){
+	matrix->modules[y * matrix->size + x] = black ? 1 : 0;
+	matrix->function[y * matrix->size + x] |= function;
+}
+
+static void qr_finder(MATRIX* matrix, int cx, int cy){
+	int dx, dy, distance;
+
+	//including the separator
+	for(dy = -4; dy <= 4; dy++){
+		for(dx = -4; dx <= 4; dx++){
+			if(cx + dx < 0 || cy + dy < 0 || cx + dx >= (int)matrix->size || cy + dy >= (int)matrix->size){
+				continue;
+			}
+			distance = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+			matrix_set(matrix, cx + dx, cy + dy, distance != 2 && distance != 4, true);
+		}
+	}
+}
+
+static void qr_alignment(MATRIX* matrix, int cx, int cy){
+	int dx, dy, distance;
+
+	for(dy = -2; dy <= 2; dy++){
+		for(dx = -2; dx <= 2; dx++){
+			distance = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+			matrix_set(matrix, cx + dx, cy + dy, distance != 1, true);
+		}
+	}
+}
+
+static void qr_format(MATRIX* matrix, unsigned mask){
+	unsigned size = matrix->size, bits, remainder, u;
+
+	//error correction level M is encoded as 0
+	remainder = mask;
+	for(u = 0; u < 10; u++){
+		remainder = (remainder << 1) ^ ((remainder >> 9) * QR_FORMAT_POLY);
+	}
+	bits = ((mask << 10) | remainder) ^ QR_FORMAT_MASK;
+
+	for(u = 0; u < 6; u++){
+		matrix_set(matrix, 8, u, (bits >> u) & 1, true);
+	}
+	matrix_set(matrix, 8, 7, (bits >> 6) & 1, true);
+	matrix_set(matrix, 8, 8, (bits >> 7) & 1, true);
+	matrix_set(matrix, 7, 8, (bits >> 8) & 1, true);
+	for(u = 9; u < 15; u++){
+		matrix_set(matrix, 14 - u, 8, (bits >> u) & 1, true);
+	}
+
+	for(u = 0; u < 8; u++){
+		matrix_set(matrix, size - 1 - u, 8, (bits >> u) & 1, true);
+	}
+	for(u = 8; u < 15; u++){
+		matrix_set(matrix, 8, size - 15 + u, (bits >> u) & 1, true);
+	}
+	matrix_set(matrix, 8, size - 8, true, true);
+}
+
+static void qr_function_patterns(MATRIX* matrix, unsigned version){
+	unsigned size = matrix->size, bits, remainder, u, v, count;
+	uint8_t* alignment = qr_versions[version].alignment;
+
+	for(u = 0; u < size; u++){
+		matrix_set(matrix, 6, u, !(u % 2), true);
+		matrix_set(matrix, u, 6, !(u % 2), true);
+	}
+
+	qr_finder(matrix, 3, 3);
+	qr_finder(matrix, size - 4, 3);
+	qr_finder(matrix, 3, size - 4);
+
+	for(count = 0; count < 3 && alignment[count]; count++){
+	}
+	for(u = 0; u < count; u++){
+		for(v = 0; v < count; v++){
+			//skip the positions overlapping the finder patterns
+			if((!u && !v) || (!u && v == count - 1) || (u == count - 1 && !v)){
+				continue;
+			}
+			qr_alignment(matrix, alignment[u], alignment[v]);
+		}
+	}
+
+	//reserve the format information areas, filled in once the mask is chosen
+	qr_format(matrix, 0);
+
+	if(version >= 7){
+		remainder = version;
+		for(u = 0; u < 12; u++){
+			remainder = (remainder << 1) ^ ((remainder >> 11) * QR_VERSION_POLY);
+		}
+		bits = (version << 12) | remainder;
+		for(u = 0; u < 18; u++){
+			matrix_set(matrix, size - 11 + u % 3, u / 3, (bits >> u) & 1, true);
+			matrix_set(matrix, u / 3, size - 11 + u % 3, (bits >> u) & 1, true);
+		}
+	}
+}
+
+//place the codewords in the two module wide zigzag columns, remainder bits stay white
+static void qr_place(MATRIX* matrix, uint8_t* codewords, size_t length){
+	int size = matrix->size, right, vertical, x, y, j;
+	size_t bit = 0;
+
+	for(right = size - 1; right >= 1; right -= 2){
+		if(right == 6){
+			right = 5;
+		}
+		for(vertical = 0; vertical < size; vertical++){
+			for(j = 0; j < 2; j++){
+				x = right - j;
+				y = ((right + 1) & 2) ? vertical : size - 1 - vertical;
+				if(!matrix->function[y * size + x] && bit < length * 8){
+					matrix_set(matrix, x, y, (codewords[bit / 8] >> (7 - bit % 8)) & 1, false);
+					bit++;
+				}
+			}
+		}
+	}
+}
+
+static bool qr_mask_bit(unsigned mask, unsigned x, unsigned y){
+	switch(mask){
+		case 0:
+			return !((x + y) % 2);
+		case 1:
+			return !(y % 2);
+		case 2:
+			return !(x % 3);
+		case 3:
+			return !((x + y) % 3);
+		case 4:
+			return !((x / 3 + y / 2) % 2);
+		case 5:
+			return !((x * y) % 2 + (x * y) % 3);
+		case 6:
+			return !(((x * y) % 2 + (x * y) % 3) % 2);
+		default:
+			return !(((x + y) % 2 + (x * y) % 3) % 2);
+	}
+}
+
+//masking is an involution, applying the same mask twice restores the matrix
+static void qr_apply_mask(MATRIX* matrix, unsigned mask){
+	unsigned x, y;
+
+	for(y = 0; y < matrix->size; y++){
+		for(x = 0; x < matrix->size; x++){
+			if(!matrix->function[y * matrix->size + x] && qr_mask_bit(mask, x, y)){
+				matrix->modules[y * matrix->size + x] ^= 1;
+			}
+		}
+	}
+}
+
+//penalty of one row or column for runs and finder-like patterns, module n is bit n
+static unsigned qr_penalty_line(uint64_t line, unsigned size){
+	unsigned penalty = 0, run = 1, u;
+	bool before, after;
+
+	for(u = 1; u < size; u++){
+		if(((line >> u) & 1) == ((line >> (u - 1)) & 1)){
+			run++;
+			penalty += (run == 5) ? 3 : (run > 5);
+		}
+		else{
+			run = 1;
+		}
+	}
+
+	//the 1:1:3:1:1 core is symmetric, modules outside the symbol are part of the white quiet zone
+	for(u = 0; u + 7 <= size; u++){
+		if(((line >> u) & 0x7F) != 0x5D){
+			continue;
+		}
+		before = (u < 4) ? !(line & ((1ULL << u) - 1)) : !((line >> (u - 4)) & 0xF);
+		after = (u + 7 >= 64) || !((line >> (u + 7)) & 0xF);
+		penalty += (before + after) * 40;
+	}
+	return penalty;
+}
+
+static unsigned qr_penalty(MATRIX* matrix){
+	uint64_t rows[MATRIX_MAX_SIZE] = {0}, columns[MATRIX_MAX_SIZE] = {0}, same;
+	unsigned size = matrix->size, penalty = 0, dark = 0, x, y;
+
+	for(y = 0; y < size; y++){
+		for(x = 0; x < size; x++){
+			if(matrix->modules[y * size + x]){
+				rows[y] |= 1ULL << x;
+				columns[x] |= 1ULL << y;
+			}
+		}
+	}
+
+	for(y = 0; y < size; y++){
+		penalty += qr_penalty_line(rows[y], size);
+		penalty += qr_penalty_line(columns[y], size);
+		dark += __builtin_popcountll(rows[y]);
+		//2x2 blocks of one color, starting at every module but the last in each row
+		if(y + 1 < size){
+			same = ~(rows[y] ^ rows[y + 1]) & ~(rows[y] ^ (rows[y] >> 1)) & ~(rows[y + 1] ^ (rows[y + 1] >> 1));
+			penalty += 3 * __builtin_popcountll(same & ((1ULL << (size - 1)) - 1));
+		}
+	}
+
+	return penalty + 10 * (abs((int)(dark * 100 / (size * size)) - 50) / 5);
+}
+
+static inline void bits_append(uint8_t* buffer, size_t* bit, unsigned value, unsigned length){
+	unsigned u;
+
+	for(u = 0; u < length; u++, (*bit)++){
+		if((value >> (length - 1 - u)) & 1){
+			buffer[*bit / 8] |= 0x80 >> (*bit % 8);
+		}
+	}
+}
+
+//byte mode at error correction level M, using the smallest version holding the data
+static ssize_t encode_qr(LOGGER logger, uint8_t* data, size_t length, MATRIX* matrix){
+	uint8_t codewords[MATRIX_MAX_CODEWORDS] = {0}, interleaved[MATRIX_MAX_CODEWORDS];
+	uint8_t ecc[MATRIX_MAX_CODEWORDS / 2][MATRIX_MAX_ECC];
+	unsigned version, count_bits = 8, capacity = 0, blocks, block, u;
+	unsigned mask, best_mask = 0, penalty, best_penalty = ~0;
+	size_t bit = 0, offset, position = 0;
+	QR_VERSION* v = NULL;
+	GALOIS gf;
+
+	for(version = 1; version <= QR_MAX_VERSION; version++){
+		v = qr_versions + version;
+		count_bits = (version < 10) ? 8 : 16;
+		capacity = v->blocks[0] * v->data + v->blocks[1] * (v->data + 1);
+		if(4 + count_bits + length * 8 <= capacity * 8){
+			break;
+		}
+	}
+	if(version > QR_MAX_VERSION){
+		debug(logger, LOG_ERROR, "QR code data too long, version %u holds at most %u bytes\n", QR_MAX_VERSION, capacity - 3);
+		return -1;
+	}
+
+	bits_append(codewords, &bit, 4, 4);
+	bits_append(codewords, &bit, length, count_bits);
+	for(u = 0; u < length; u++){
+		bits_append(codewords, &bit, data[u], 8);
+	}
+	//terminator, then pad to full codewords
+	bit += (capacity * 8 - bit < 4) ? (capacity * 8 - bit) : 4;
+	bit = (bit + 7) & ~7;
+	for(u = bit / 8; u < capacity; u++){
+		codewords[u] = ((u - bit / 8) % 2) ? QR_PAD_B : QR_PAD_A;
+	}
+
+	galois_init(&gf, QR_GF_POLY);
+	blocks = v->blocks[0] + v->blocks[1];
+	for(block = 0, offset = 0; block < blocks; block++){
+		rs_encode(&gf, 0, codewords + offset, v->data + (block >= v->blocks[0]), ecc[block], v->ecc);
+		offset += v->data + (block >= v->blocks[0]);
+	}
+
+	//interleave data codewords, then error correction codewords, across the blocks
+	for(u = 0; u <= v->data; u++){
+		for(block = 0, offset = 0; block < blocks; block++){
+			if(u < v->data + (block >= v->blocks[0])){
+				interleaved[position++] = codewords[offset + u];
+			}
+			offset += v->data + (block >= v->blocks[0]);
+		}
+	}
+	for(u = 0; u < v->ecc; u++){
+		for(block = 0; block < blocks; block++){
+			interleaved[position++] = ecc[block][u];
+		}
+	}
+
+	matrix->size = 17 + 4 * version;
+	memset(matrix->modules, 0, matrix->size * matrix->size);
+	memset(matrix->function, 0, matrix->size * matrix->size);
+	qr_function_patterns(matrix, version);
+	qr_place(matrix, interleaved, position);
+
+	for(mask = 0; mask < 8; mask++){
+		qr_apply_mask(matrix, mask);
+		qr_format(matrix, mask);
+		penalty = qr_penalty(matrix);
+		if(penalty < best_penalty){
+			best_penalty = penalty;
+			best_mask = mask;
+		}
+		qr_apply_mask(matrix, mask);
+	}
+	qr_apply_mask(matrix, best_mask);
+	qr_format(matrix, best_mask);
+
+	debug(logger, LOG_DEBUG, "Encoded QR code version %u with mask %u\n", version, best_mask);
+	return matrix->size;
+}
+
+typedef struct /*_DATAMATRIX_PLACEMENT*/ {
+	int rows;
+	int columns;
+	uint16_t* array;
+} DATAMATRIX_PLACEMENT;
+
+//module placement as described in the ECC200 reference algorithm, values are 10 * codeword + bit
+static void datamatrix_module(DATAMATRIX_PLACEMENT* p, int row, int column, unsigned codeword, unsigned bit){
+	if(row < 0){
+		row += p->rows;
+		column += 4 - ((p->rows + 4) % 8);
+	}
+	if(column < 0){
+		column += p->columns;
+		row += 4 - ((p->columns + 4) % 8);
+	}
+	p->array[row * p->columns + column] = 10 * codeword + bit;
+}
+
+static void datamatrix_utah(DATAMATRIX_PLACEMENT* p, int row, int column, unsigned codeword){
+	datamatrix_module(p, row - 2, column - 2, codeword, 1);
+	datamatrix_module(p, row - 2, column - 1, codeword, 2);
+	datamatrix_module(p, row - 1, column - 2, codeword, 3);
+	datamatrix_module(p, row - 1, column - 1, codeword, 4);
+	datamatrix_module(p, row - 1, column, codeword, 5);
+	datamatrix_module(p, row, column - 2, codeword, 6);
+	datamatrix_module(p, row, column - 1, codeword, 7);
+	datamatrix_module(p, row, column, codeword, 8);
+}
+
+//the four corner cases, as pairs of row and column for bits 1 through 8
+static void datamatrix_corner(DATAMATRIX_PLACEMENT* p, unsigned corner, unsigned codeword){
+	int r = p->rows, c = p->columns, u;
+	int corners[4][16] = {
+		{r - 1, 0, r - 1, 1, r - 1, 2, 0, c - 2, 0, c - 1, 1, c - 1, 2, c - 1, 3, c - 1},
+		{r - 3, 0, r - 2, 0, r - 1, 0, 0, c - 4, 0, c - 3, 0, c - 2, 0, c - 1, 1, c - 1},
+		{r - 3, 0, r - 2, 0, r - 1, 0, 0, c - 2, 0, c - 1, 1, c - 1, 2, c - 1, 3, c - 1},
+		{r - 1, 0, r - 1, c - 1, 0, c - 3, 0, c - 2, 0, c - 1, 1, c - 3, 1, c - 2, 1, c - 1}
+	};
+
+	for(u = 0; u < 8; u++){
+		datamatrix_module(p, corners[corner][2 * u], corners[corner][2 * u + 1], codeword, u + 1);
+	}
+}
+
+static void datamatrix_place(DATAMATRIX_PLACEMENT* p){
+	int row = 4, column = 0, r = p->rows, c = p->columns;
+	unsigned codeword = 1;
+
+	do{
+		if(row == r && column == 0){
+			datamatrix_corner(p, 0, codeword++);
+		}
+		if(row == r - 2 && column == 0 && (c % 4)){
+			datamatrix_corner(p, 1, codeword++);
+		}
+		if(row == r - 2 && column == 0 && (c % 8) == 4){
+			datamatrix_corner(p, 2, codeword++);
+		}
+		if(row == r + 4 && column == 2 && !(c % 8)){
+			datamatrix_corner(p, 3, codeword++);
+		}
+
+		do{
+			if(row < r && column >= 0 && !p->array[row * c + column]){
+				datamatrix_utah(p, row, column, codeword++);
+			}
+			row -= 2;
+			column += 2;
+		} while(row >= 0 && column < c);
+		row += 1;
+		column += 3;
+
+		do{
+			if(row >= 0 && column < c && !p->array[row * c + column]){
+				datamatrix_utah(p, row, column, codeword++);
+			}
+			row += 2;
+			column -= 2;
+		} while(row < r && column >= 0);
+		row += 3;
+		column += 1;
+	} while(row < r || column < c);
+
+	//fixed pattern in the unused lower right corner
+	if(!p->array[r * c - 1]){
+		p->array[r * c - 1] = p->array[r * c - c - 2] = 1;
+	}
+}
+
+//ECC200 in ASCII encodation, using the smallest square symbol holding the data
+static ssize_t encode_datamatrix(LOGGER logger, uint8_t* data, size_t length, MATRIX* matrix){
+	uint8_t codewords[MATRIX_MAX_CODEWORDS];
+	uint16_t placement[MATRIX_MAX_SIZE * MATRIX_MAX_SIZE] = {0};
+	DATAMATRIX_SIZE* symbol = NULL;
+	DATAMATRIX_PLACEMENT p;
+	size_t count = 0, u;
+	unsigned value, x, y, s;
+	GALOIS gf;
+
+	for(u = 0; u < length && count + 2 < sizeof(codewords); u++){
+		if(u + 1 < length && isdigit(data[u]) && isdigit(data[u + 1])){
+			codewords[count++] = 130 + (data[u] - '0') * 10 + (data[u + 1] - '0');
+			u++;
+		}
+		else if(data[u] < 128){
+			codewords[count++] = data[u] + 1;
+		}
+		else{
+			codewords[count++] = DATAMATRIX_UPPER_SHIFT;
+			codewords[count++] = data[u] - 127;
+		}
+	}
+
+	for(s = 0; s < sizeof(datamatrix_sizes) / sizeof(datamatrix_sizes[0]); s++){
+		if(u == length && count <= datamatrix_sizes[s].data){
+			symbol = datamatrix_sizes + s;
+			break;
+		}
+	}
+	if(!symbol){
+		debug(logger, LOG_ERROR, "Data Matrix data too long, the largest symbol holds %u codewords\n",
+				datamatrix_sizes[s - 1].data);
+		return -1;
+	}
+
+	//the first pad codeword is fixed, the following ones are randomized by position
+	for(u = count; u < symbol->data; u++){
+		value = DATAMATRIX_PAD + ((149 * (u + 1)) % 253) + 1;
+		codewords[u] = (u == count) ? DATAMATRIX_PAD : ((value > 254) ? value - 254 : value);
+	}
+
+	galois_init(&gf, DATAMATRIX_GF_POLY);
+	rs_encode(&gf, 1, codewords, symbol->data, codewords + symbol->data, symbol->ecc);
+
+	p.rows = p.columns = symbol->size - 2;
+	p.array = placement;
+	datamatrix_place(&p);
+
+	matrix->size = symbol->size;
+	for(y = 0; y < symbol->size; y++){
+		for(x = 0; x < symbol->size; x++){
+			//solid finder on the left and bottom, alternating timing on the top and right
+			if(x == 0 || y == symbol->size - 1){
+				value = 1;
+			}
+			else if(y == 0){
+				value = !(x % 2);
+			}
+			else if(x == symbol->size - 1){
+				value = y % 2;
+			}
+			else{
+				value = placement[(y - 1) * p.columns + x - 1];
+				if(value >= 10){
+					value = (codewords[value / 10 - 1] >> (8 - value % 10)) & 1;
+				}
+			}
+			matrix->modules[y * symbol->size + x] = value;
+		}
+	}
+
+	debug(logger, LOG_DEBUG, "Encoded %ux%u Data Matrix symbol\n", symbol->size, symbol->size);
+	return matrix->size;
+}
+
+bool matrix_symbology(SYMBOLOGY symbology){
+	return symbology == SYMBOLOGY_QR || symbology == SYMBOLOGY_DATAMATRIX;
+}
+
+//quiet zone required by the symbology, in modules
+unsigned matrix_quiet_zone(SYMBOLOGY symbology){
+	return (symbology == SYMBOLOGY_QR) ? 4 : 1;
+}
+
+//pixels of one module column, with the top row at the far edge of the symbol
+uint64_t matrix_column(uint8_t* modules, unsigned size, unsigned column, unsigned module_size){
+	uint64_t pixels = 0;
+	unsigned y;
+
+	for(y = 0; y < size; y++){
+		if(modules[y * size + column]){
+			pixels |= ((1ULL << module_size) - 1) << ((size - 1 - y) * module_size);
+		}
+	}
+	return pixels;
+}
+
+//encode data into a square module matrix of at most MATRIX_MAX_SIZE modules, returns the side length
+ssize_t matrix_encode(LOGGER logger, SYMBOLOGY symbology, char* data, uint8_t* buffer){
+	MATRIX matrix = {
+		.size = 0,
+		.modules = buffer
+	};
+	ssize_t rv = -1;
+
+	switch(symbology){
+		case SYMBOLOGY_QR:
+			rv = encode_qr(logger, (uint8_t*)data, strlen(data), &matrix);
+			break;
+		case SYMBOLOGY_DATAMATRIX:
+			rv = encode_datamatrix(logger, (uint8_t*)data, strlen(data), &matrix);
+			break;
+		default:
+			break;
+	}
+
+	if(rv < 0){
+		debug(logger, LOG_ERROR, "Failed to encode %s symbol\n", barcode_symbology_name(symbology));
+	}
+	return rv;
+}
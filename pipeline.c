@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "textrender.h"
+#include "pt1230.h"
+
+/*
+ * Pipelined transfer
+ * An input thread reads the input into a ring of records, the job thread parses and
+ * encodes them as usual and queues the filled output buffers into a second ring, which
+ * a writer thread transfers to the device. Both rings have a single producer and a single
+ * consumer, the indices are only ever advanced by their owner, so records are passed
+ * without locking. The lock is taken only to sleep on an empty or full ring, which also
+ * provides the back-pressure between the stages.
+ * Status reports are read by the writer thread while it transfers data, the job thread
+ * drains the output ring before reading status reports itself.
+ */
+
+typedef struct /*_RING_RECORD*/ {
+	ssize_t length;
+	int error;
+	uint8_t data[OUTPUT_BUFFER_LENGTH];
+} RING_RECORD;
+
+struct RING {
+	RING_RECORD record[PIPELINE_RING_LENGTH];
+	//records produced and consumed
+	atomic_size_t tail;
+	atomic_size_t head;
+	//set while either side sleeps on the ring
+	atomic_bool producer_waiting;
+	atomic_bool consumer_waiting;
+	atomic_bool closed;
+	atomic_bool failed;
+	//consumer offset into a partially read record
+	size_t offset;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+
+struct PIPELINE {
+	RING input;
+	RING output;
+	pthread_t reader;
+	pthread_t writer;
+	bool reader_started;
+	bool writer_started;
+	LOGGER logger;
+	DEVICE* device;
+	int fd;
+};
+
+static void ring_init(RING* ring){
+	atomic_init(&(ring->tail), 0);
+	atomic_init(&(ring->head), 0);
+	atomic_init(&(ring->producer_waiting), false);
+	atomic_init(&(ring->consumer_waiting), false);
+	atomic_init(&(ring->closed), false);
+	atomic_init(&(ring->failed), false);
+	ring->offset = 0;
+	pthread_mutex_init(&(ring->lock), NULL);
+	pthread_cond_init(&(ring->changed), NULL);
+}
+
+static void ring_free(RING* ring){
+	pthread_mutex_destroy(&(ring->lock));
+	pthread_cond_destroy(&(ring->changed));
+}
+
+//wake the other side after advancing an index, only if it is sleeping
+static void ring_notify(RING* ring, atomic_bool* waiting){
+	if(atomic_load(waiting)){
+		pthread_mutex_lock(&(ring->lock));
+		pthread_cond_broadcast(&(ring->changed));
+		pthread_mutex_unlock(&(ring->lock));
+	}
+}
+
+static bool ring_readable(RING* ring){
+	return atomic_load(&(ring->tail)) != atomic_load(&(ring->head));
+}
+
+static bool ring_writable(RING* ring){
+	return atomic_load(&(ring->tail)) - atomic_load(&(ring->head)) < PIPELINE_RING_LENGTH;
+}
+
+static bool ring_empty(RING* ring){
+	return !ring_readable(ring) || atomic_load(&(ring->failed));
+}
+
+//sleep until the condition holds or the ring was closed
+static void ring_wait(RING* ring, atomic_bool* waiting, bool (*condition)(RING*)){
+	if(condition(ring)){
+		return;
+	}
+
+	pthread_mutex_lock(&(ring->lock));
+	atomic_store(waiting, true);
+	while(!condition(ring) && !atomic_load(&(ring->closed))){
+		pthread_cond_wait(&(ring->changed), &(ring->lock));
+	}
+	atomic_store(waiting, false);
+	pthread_mutex_unlock(&(ring->lock));
+}
+
+//queue data for the device, blocks while the ring is full
+int ring_write(RING* ring, size_t length, uint8_t* data){
+	RING_RECORD* record;
+	size_t offset, chunk;
+
+	for(offset = 0; offset < length; offset += chunk){
+		ring_wait(ring, &(ring->producer_waiting), ring_writable);
+		if(atomic_load(&(ring->failed))){
+			return -1;
+		}
+
+		record = ring->record + (atomic_load(&(ring->tail)) % PIPELINE_RING_LENGTH);
+		chunk = (length - offset > sizeof(record->data)) ? sizeof(record->data) : length - offset;
+		memcpy(record->data, data + offset, chunk);
+		record->length = chunk;
+		atomic_fetch_add(&(ring->tail), 1);
+		ring_notify(ring, &(ring->consumer_waiting));
+	}
+	return 0;
+}
+
+//wait until all queued data was transferred
+int ring_drain(RING* ring){
+	ring_wait(ring, &(ring->producer_waiting), ring_empty);
+	return atomic_load(&(ring->failed)) ? -1 : 0;
+}
+
+//read up to length bytes from the input ring, returns 0 at end of input and -1 on errors
+ssize_t ring_read(RING* ring, size_t length, uint8_t* data){
+	RING_RECORD* record;
+	size_t chunk;
+
+	ring_wait(ring, &(ring->consumer_waiting), ring_readable);
+	record = ring->record + (atomic_load(&(ring->head)) % PIPELINE_RING_LENGTH);
+
+	//the final record marks the end of input or an error and is never consumed
+	if(record->length <= 0){
+		errno = record->error;
+		return record->length;
+	}
+
+	chunk = (length > record->length - ring->offset) ? record->length - ring->offset : length;
+	memcpy(data, record->data + ring->offset, chunk);
+	ring->offset += chunk;
+	if(ring->offset == record->length){
+		ring->offset = 0;
+		atomic_fetch_add(&(ring->head), 1);
+		ring_notify(ring, &(ring->producer_waiting));
+	}
+	return chunk;
+}
+
+static void* pipeline_reader(void* context){
+	PIPELINE* pipeline = (PIPELINE*)context;
+	RING* ring = &(pipeline->input);
+	RING_RECORD* record;
+	ssize_t bytes;
+
+	//the reader is only ever cancelled while blocked reading the input
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	do{
+		ring_wait(ring, &(ring->producer_waiting), ring_writable);
+		if(atomic_load(&(ring->closed))){
+			break;
+		}
+
+		record = ring->record + (atomic_load(&(ring->tail)) % PIPELINE_RING_LENGTH);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		do{
+			bytes = read(pipeline->fd, record->data, sizeof(record->data));
+		} while(bytes < 0 && errno == EINTR);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		record->length = bytes;
+		record->error = (bytes < 0) ? errno : 0;
+		atomic_fetch_add(&(ring->tail), 1);
+		ring_notify(ring, &(ring->consumer_waiting));
+	} while(bytes > 0);
+	return NULL;
+}
+
+static void* pipeline_writer(void* context){
+	PIPELINE* pipeline = (PIPELINE*)context;
+	RING* ring = &(pipeline->output);
+	RING_RECORD* record;
+
+	while(true){
+		ring_wait(ring, &(ring->consumer_waiting), ring_readable);
+		if(atomic_load(&(ring->closed))){
+			break;
+		}
+
+		//after a failure, records are discarded to keep the producer from blocking
+		record = ring->record + (atomic_load(&(ring->head)) % PIPELINE_RING_LENGTH);
+		if(!atomic_load(&(ring->failed))
+				&& device_write(pipeline->logger, pipeline->device, record->length, record->data) < 0){
+			atomic_store(&(ring->failed), true);
+		}
+		atomic_fetch_add(&(ring->head), 1);
+		ring_notify(ring, &(ring->producer_waiting));
+	}
+	return NULL;
+}
+
+int pipeline_start(CONF* cfg){
+	PIPELINE* pipeline = calloc(1, sizeof(PIPELINE));
+
+	if(!pipeline){
+		debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+		return -1;
+	}
+	ring_init(&(pipeline->input));
+	ring_init(&(pipeline->output));
+	pipeline->logger = cfg->logger;
+	pipeline->device = &(cfg->device);
+	pipeline->fd = cfg->input.fd;
+	cfg->pipeline = pipeline;
+
+	//text given on the command line does not need to be read
+	if(!cfg->text){
+		if(pthread_create(&(pipeline->reader), NULL, pipeline_reader, pipeline)){
+			debug(cfg->logger, LOG_ERROR, "Failed to start input thread\n");
+			return -1;
+		}
+		pipeline->reader_started = true;
+		cfg->input.source = &(pipeline->input);
+	}
+
+	if(pthread_create(&(pipeline->writer), NULL, pipeline_writer, pipeline)){
+		debug(cfg->logger, LOG_ERROR, "Failed to start device writer thread\n");
+		return -1;
+	}
+	pipeline->writer_started = true;
+	cfg->device.output = &(pipeline->output);
+	debug(cfg->logger, LOG_DEBUG, "Started pipelined transfer\n");
+	return 0;
+}
+
+void pipeline_stop(CONF* cfg){
+	PIPELINE* pipeline = cfg->pipeline;
+
+	if(!pipeline){
+		return;
+	}
+
+	//queued data is discarded, successful jobs have drained the output already
+	cfg->input.source = NULL;
+	cfg->device.output = NULL;
+	atomic_store(&(pipeline->input.closed), true);
+	atomic_store(&(pipeline->output.closed), true);
+	pthread_mutex_lock(&(pipeline->input.lock));
+	pthread_cond_broadcast(&(pipeline->input.changed));
+	pthread_mutex_unlock(&(pipeline->input.lock));
+	pthread_mutex_lock(&(pipeline->output.lock));
+	pthread_cond_broadcast(&(pipeline->output.changed));
+	pthread_mutex_unlock(&(pipeline->output.lock));
+
+	if(pipeline->reader_started){
+		pthread_cancel(pipeline->reader);
+		pthread_join(pipeline->reader, NULL);
+	}
+	if(pipeline->writer_started){
+		pthread_join(pipeline->writer, NULL);
+	}
+
+	ring_free(&(pipeline->input));
+	ring_free(&(pipeline->output));
+	free(pipeline);
+	cfg->pipeline = NULL;
+}
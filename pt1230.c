@@ -7,22 +7,50 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
+#include <poll.h>
+#include <time.h>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "textrender.h"
 #include "pt1230.h"
 
 int usage(char* fn){
 	printf("PT1230 Interface\n");
 	printf("Valid arguments:\n");
 	printf("\t-h\t\tPrint this text\n");
-	printf("\t-d <devicenode>\tSet output device node (Default: %s)\n", DEFAULT_DEVICENODE);
+	printf("\t-d <devicenode>\tSet output device node, repeat to spool to several printers (Default: %s)\n", DEFAULT_DEVICENODE);
 	printf("\t-f <inputfile>\tSpecify input file (Default: read from stdin)\n");
 	printf("\t-v <verbosity>\t\tSet output verbosity (0-4, Default: 1)\n");
 	printf("\t-s\t\tQuery printer status (default)\n");
-	printf("\t-b\t\tBitmap mode\n");
+	printf("\t-b\t\tBitmap mode (ASCII, PBM, XBM or CUPS raster input)\n");
 	printf("\t-l\t\tLinemap mode\n");
+	printf("\t-x <lines>\tRaster lines per linemap bar or barcode module (Default: 1, barcodes %d)\n", BARCODE_MODULE_WIDTH);
+	printf("\t-H <pixels>\tLinemap bar height (Default: full printable width)\n");
+	printf("\t-O <pixels>\tLinemap bar offset from the tape edge (Default: 0)\n");
+	printf("\t-r\t\tRaw packed bitmap mode\n");
+	printf("\t-t <text>\tPrint text label (\\n separates lines)\n");
+	printf("\t-F <fontspec>\tFont for text labels (Default: %s)\n", DEFAULT_FONT);
+	printf("\t-B <symbology> <data>\tPrint barcode (code128, ean13, code39, qr or datamatrix)\n");
+	printf("\t-T <template>\tPrint labels from a template, fields are read from the input\n");
+	printf("\t-C\t\tRead template fields as CSV, one label per row\n");
+	printf("\t-W <workers>\tRender threads for CSV batches (Default: one per CPU)\n");
+	printf("\t-p\t\tPipelined transfer: read input and write to the device in separate threads\n");
+	printf("\t-L <lines>\tPrint longer labels in chained segments of this many raster lines, at most half the printer buffer (Default: %d, 0 disables)\n", SEGMENT_LINES);
 	printf("\t-c\t\tChain print (do not feed after printing)\n");
 	printf("\t-m\t\tPrint cut marker after label\n");
+	printf("\t-z\t\tCompress raster data (TIFF/PackBits)\n");
+	printf("\t-w <width>\tOverride media width in mm (Default: as reported by printer)\n");
 	printf("\t-u\t\tPrefix log output with severity (CUPS-compatible)\n");
+	printf("\t-D <socket>\tRun as print daemon accepting jobs on a local socket\n");
+	printf("\t-S <socket>\tSubmit job to a print daemon instead of printing directly\n");
+	printf("\t-j <file>\tAppend per-job statistics as JSON records to file (- for stdout)\n");
 	//TODO invert flag?
 	return 1;
 }
@@ -52,77 +80,279 @@ void debug(LOGGER logger, unsigned severity, char* fmt, ...){
 	va_end(args);
 }
 
-int fetch_status(LOGGER logger, int fd, int attempts, unsigned timeout, size_t buffer_length, char* buffer){
-	unsigned run;
+int print_status(unsigned count, PROTO_STATUS* data){
+	unsigned i, j;
+
+	for(i = 0; i < count; i++){
+		printf("Magic ");
+		for(j = 0; j < sizeof(data[i].magic); j++){
+			printf("%02X ", data[i].magic[j]);
+		}
+		printf("\nMedia width: %d\n", data[i].media_width);
+		printf("Media type: %d\n", data[i].media_type);
+		printf("Media length: %d\n", data[i].media_length);
+		printf("Error descriptors %02X %02X\n", data[i].error1, data[i].error2);
+		printf("Status %02X\n", data[i].status);
+		printf("Phase %02X High %02X Low %02X\n", data[i].phase, data[i].phase_high, data[i].phase_low);
+		printf("Notification %02X\n", data[i].notification);
+	}
+
+	return 0;
+}
+
+uint64_t monotonic_ms(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+uint64_t monotonic_us(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+int remaining_ms(uint64_t deadline){
+	uint64_t now = monotonic_ms();
+	return (now >= deadline) ? 0 : deadline - now;
+}
+
+//read all pending status reports without blocking
+int read_status(LOGGER logger, DEVICE* device, size_t buffer_length, char* buffer){
 	ssize_t bytes;
 
 	if(!buffer || buffer_length < sizeof(PROTO_STATUS) * 4){
 		return -1;
 	}
 
-	for(run = 0; run < attempts; run++){
-		if(run > 0){
-			usleep(timeout);
+	bytes = read(device->fd, buffer, buffer_length);
+	device->syscalls++;
+
+	if(bytes < 0){
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+			return 0;
 		}
+		debug(logger, LOG_ERROR, "device/read: %s\n", strerror(errno));
+		return -1;
+	}
 
-		bytes = read(fd, buffer, buffer_length);
+	//the device only ever should send full PROTO_STATUS reports
+	//that is, according to some document.
+	if(bytes % sizeof(PROTO_STATUS) != 0){
+		debug(logger, LOG_ERROR, "Invalid response from device\n");
+		return -1;
+	}
 
-		if(bytes < 0){
-			debug(logger, LOG_ERROR, "device/read: %s\n", strerror(errno));
+	device->stats.status_frames += bytes / sizeof(PROTO_STATUS);
+	return bytes / sizeof(PROTO_STATUS);
+}
+
+//wait up to timeout milliseconds for status reports
+int fetch_status(LOGGER logger, DEVICE* device, unsigned timeout, size_t buffer_length, char* buffer){
+	uint64_t deadline = monotonic_ms() + timeout;
+	struct pollfd pfd = {
+		.fd = device->fd,
+		.events = POLLIN
+	};
+	int rv;
+
+	//the pipeline writer reads status reports while transferring
+	if(device->output && ring_drain(device->output) < 0){
+		return -1;
+	}
+
+	do{
+		rv = poll(&pfd, 1, remaining_ms(deadline));
+		device->syscalls++;
+
+		if(rv < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			debug(logger, LOG_ERROR, "device/poll: %s\n", strerror(errno));
 			return -1;
 		}
 
-		if(bytes == 0){
-			continue;
+		if(rv == 0){
+			return 0;
 		}
 
-		//the device only ever should send full PROTO_STATUS reports
-		//that is, according to some document.
-		if(bytes % sizeof(PROTO_STATUS) != 0){
-			debug(logger, LOG_ERROR, "Invalid response from device\n");
+		if(pfd.revents & (POLLERR | POLLHUP | POLLNVAL)){
+			debug(logger, LOG_ERROR, "Device reported an error condition\n");
 			return -1;
 		}
 
-		return bytes / sizeof(PROTO_STATUS);
-	}
+		errno = 0;
+		rv = read_status(logger, device, buffer_length, buffer);
+		if(rv != 0){
+			return rv;
+		}
+
+		//a readable device without data (eg. at end of file) has nothing more to tell
+		if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+			return 0;
+		}
+	} while(remaining_ms(deadline) > 0);
+
 	return 0;
 }
 
-int print_status(unsigned count, PROTO_STATUS* data){
-	unsigned i, j;
+//handle status reports, returns -1 on device errors, 1 once printing has completed
+int handle_status(LOGGER logger, DEVICE* device, unsigned count, PROTO_STATUS* status){
+	unsigned i;
+	int rv = 0;
+
+	if(logger.verbosity >= LOG_DEBUG){
+		print_status(count, status);
+	}
 
 	for(i = 0; i < count; i++){
-		printf("Magic ");
-		for(j = 0; j < sizeof(data[i].magic); j++){
-			printf("%02X ", data[i].magic[j]);
+		device->status = status[i];
+		switch(status[i].status){
+			case 0x00:
+				//status request response
+				break;
+			case 0x01:
+				debug(logger, LOG_INFO, "Printing completed successfully\n");
+				device->completed++;
+				rv = (rv < 0) ? rv : 1;
+				break;
+			case 0x02:
+				debug(logger, LOG_ERROR, "Device reported an error (%02X %02X), status dump follows\n", status[i].error1, status[i].error2);
+				print_status(1, status + i);
+				rv = -1;
+				break;
+			case 0x06:
+				debug(logger, LOG_DEBUG, "Phase change to %02X\n", status[i].phase);
+				//phase 01 is the printing state
+				if(status[i].phase == 0x01){
+					device->started++;
+				}
+				break;
 		}
-		printf("\nMedia width: %d\n", data[i].media_width);
-		printf("Media type: %d\n", data[i].media_type);
-		printf("Media length: %d\n", data[i].media_length);
-		printf("Error descriptors %02X %02X\n", data[i].error1, data[i].error2);
-		printf("Status %02X\n", data[i].status);
-		printf("Phase %02X High %02X Low %02X\n", data[i].phase, data[i].phase_high, data[i].phase_low);
-		printf("Notification %02X\n", data[i].notification);
+	}
+	return rv;
+}
+
+//wait until the device accepts data, handling status reports sent in the meantime
+int device_wait(LOGGER logger, DEVICE* device, uint64_t deadline){
+	char status_buffer[DEVICE_BUFFER_LENGTH * sizeof(PROTO_STATUS)];
+	struct pollfd pfd = {
+		.fd = device->fd,
+		.events = POLLIN | POLLOUT
+	};
+	int rv;
+
+	rv = poll(&pfd, 1, remaining_ms(deadline));
+	device->syscalls++;
+
+	if(rv < 0){
+		if(errno == EINTR){
+			return 0;
+		}
+		debug(logger, LOG_ERROR, "device/poll: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if(rv == 0){
+		debug(logger, LOG_ERROR, "Device write timed out\n");
+		return -1;
 	}
 
+	if(pfd.revents & (POLLERR | POLLHUP | POLLNVAL)){
+		debug(logger, LOG_ERROR, "Device reported an error condition\n");
+		return -1;
+	}
+
+	if(pfd.revents & POLLIN){
+		rv = read_status(logger, device, sizeof(status_buffer), status_buffer);
+		if(rv < 0 || handle_status(logger, device, rv, (PROTO_STATUS*)status_buffer) < 0){
+			return -1;
+		}
+	}
 	return 0;
 }
 
-int send_command(LOGGER logger, int fd, size_t length, char* buffer){
+int device_write(LOGGER logger, DEVICE* device, size_t length, uint8_t* data){
+	uint64_t deadline = monotonic_ms() + DEFAULT_WRITE_TIMEOUT;
+	size_t offset = 0;
 	ssize_t bytes;
 
-	bytes = write(fd, buffer, length);
+	while(offset < length){
+		bytes = write(device->fd, data + offset, length - offset);
+		device->syscalls++;
+		device->stats.writes++;
 
-	if(bytes < 0){
-		debug(logger, LOG_ERROR, "device/write: %s\n", strerror(errno));
+		if(bytes < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+				if(device_wait(logger, device, deadline) < 0){
+					return -1;
+				}
+				continue;
+			}
+			debug(logger, LOG_ERROR, "device/write: %s\n", strerror(errno));
+			return -1;
+		}
+
+		if(bytes == 0){
+			debug(logger, LOG_ERROR, "Incomplete write on device\n");
+			return -1;
+		}
+
+		//the deadline applies to stalls, not to the complete transfer
+		offset += bytes;
+		device->stats.bytes_sent += bytes;
+		deadline = monotonic_ms() + DEFAULT_WRITE_TIMEOUT;
+	}
+	return 0;
+}
+
+//write directly or queue for the pipeline writer
+static int device_queue(LOGGER logger, DEVICE* device, size_t length, uint8_t* data){
+	if(device->output){
+		return ring_write(device->output, length, data);
+	}
+	return device_write(logger, device, length, data);
+}
+
+int device_flush(LOGGER logger, DEVICE* device, bool sync){
+	if(device_queue(logger, device, device->fill, device->buffer) < 0){
 		return -1;
 	}
+	device->fill = 0;
 
-	if(bytes != length){
-		debug(logger, LOG_ERROR, "Incomplete write on device\n");
+	//print commands need to be transferred before waiting on the printer
+	if(sync && device->output && ring_drain(device->output) < 0){
 		return -1;
 	}
 
+	//character devices may not support syncing, which is fine
+	if(sync){
+		device->syscalls++;
+		if(fdatasync(device->fd) < 0 && errno != EINVAL && errno != EROFS){
+			debug(logger, LOG_ERROR, "device/sync: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int send_command(LOGGER logger, DEVICE* device, size_t length, char* buffer){
+	//flush if the command does not fit into the remaining buffer
+	if(device->fill + length > sizeof(device->buffer)){
+		if(device_flush(logger, device, false) < 0){
+			return -1;
+		}
+	}
+
+	//commands larger than the buffer are written directly
+	if(length > sizeof(device->buffer)){
+		return device_queue(logger, device, length, (uint8_t*)buffer);
+	}
+
+	memcpy(device->buffer + device->fill, buffer, length);
+	device->fill += length;
 	return 0;
 }
 
@@ -130,6 +360,8 @@ int parse_arguments(CONF* cfg, int argc, char** argv){
 	unsigned i;
 	char* device = NULL;
 	char* input = NULL;
+	char* stats = NULL;
+	uint64_t start;
 
 	for(i = 0; i < argc; i++){
 		if(argv[i][0] == '-'){
@@ -137,7 +369,11 @@ int parse_arguments(CONF* cfg, int argc, char** argv){
 				case 'h':
 					return -1;
 				case 'd':
-					device = argv[++i];
+					if(cfg->spool_devices >= SPOOL_MAX_DEVICES){
+						debug(cfg->logger, LOG_ERROR, "Too many devices, at most %d are supported\n", SPOOL_MAX_DEVICES);
+						return -1;
+					}
+					cfg->spool_device[cfg->spool_devices++] = argv[++i];
 					break;
 				case 'f':
 					input = argv[++i];
@@ -154,15 +390,79 @@ int parse_arguments(CONF* cfg, int argc, char** argv){
 				case 'l':
 					cfg->mode = MODE_LINEMAP;
 					break;
+				case 'r':
+					cfg->mode = MODE_PACKED;
+					break;
+				case 'x':
+					cfg->bars.width = strtoul(argv[++i], NULL, 10);
+					break;
+				case 'H':
+					cfg->bars.height = strtoul(argv[++i], NULL, 10);
+					break;
+				case 'O':
+					cfg->bars.offset = strtoul(argv[++i], NULL, 10);
+					break;
+				case 't':
+					cfg->mode = MODE_TEXT;
+					cfg->text = argv[++i];
+					break;
+				case 'F':
+					cfg->renderer.fontspec = argv[++i];
+					break;
+				case 'B':
+					cfg->mode = MODE_BARCODE;
+					if(i + 2 >= argc || barcode_symbology(argv[i + 1]) < 0){
+						debug(cfg->logger, LOG_ERROR, "Barcode mode requires a known symbology and data\n");
+						return -1;
+					}
+					cfg->symbology = barcode_symbology(argv[++i]);
+					cfg->text = argv[++i];
+					break;
+				case 'T':
+					cfg->mode = MODE_TEMPLATE;
+					if(i + 1 >= argc || strlen(argv[i + 1]) >= sizeof(cfg->template.path)){
+						debug(cfg->logger, LOG_ERROR, "Template mode requires a template path\n");
+						return -1;
+					}
+					strncpy(cfg->template.path, argv[++i], sizeof(cfg->template.path) - 1);
+					break;
+				case 'C':
+					cfg->csv = true;
+					break;
+				case 'W':
+					cfg->workers = strtoul(argv[++i], NULL, 10);
+					break;
+				case 'p':
+					cfg->pipelined = true;
+					break;
+				case 'L':
+					cfg->device.segment_limit = strtoul(argv[++i], NULL, 10);
+					break;
 				case 'c':
 					cfg->chain_print = true;
 					break;
 				case 'm':
 					cfg->print_marker = true;
 					break;
+				case 'z':
+					cfg->device.compress = true;
+					break;
+				case 'w':
+					cfg->media_width = strtoul(argv[++i], NULL, 10);
+					break;
+				case 'D':
+					cfg->daemon = true;
+					cfg->socket_path = argv[++i];
+					break;
+				case 'S':
+					cfg->socket_path = argv[++i];
+					break;
 				case 'u':
 					cfg->logger.cups_logging = true;
 					break;
+				case 'j':
+					stats = argv[++i];
+					break;
 				default:
 					debug(cfg->logger, LOG_ERROR, "Unknown command line argument %s\n", argv[i]);
 					return -1;
@@ -174,273 +474,1424 @@ int parse_arguments(CONF* cfg, int argc, char** argv){
 		}
 	}
 
-	//Open output device
-	if(!device){
-		device = DEFAULT_DEVICENODE;
-	}
-	debug(cfg->logger, LOG_INFO, "Opening device at %s\n", device);
-	cfg->device_fd = open(device, O_RDWR | O_SYNC);
-	if(cfg->device_fd < 0){
-		debug(cfg->logger, LOG_ERROR, "Failed to open printer device node\n");
+	//multiple printers are only driven by the spooler
+	if(cfg->spool_devices > 1 && !cfg->daemon){
+		debug(cfg->logger, LOG_ERROR, "Multiple devices require daemon mode\n");
 		return -1;
 	}
 
+	//Open output device, jobs submitted to a daemon do not access it and the spooler opens its printers itself
+	if((!cfg->socket_path || cfg->daemon) && cfg->spool_devices <= 1){
+		device = cfg->spool_devices ? cfg->spool_device[0] : DEFAULT_DEVICENODE;
+		debug(cfg->logger, LOG_INFO, "Opening device at %s\n", device);
+		start = monotonic_us();
+		cfg->device.fd = open(device, O_RDWR | O_NONBLOCK);
+		cfg->device.stats.phase_us[PHASE_OPEN] += monotonic_us() - start;
+		if(cfg->device.fd < 0){
+			debug(cfg->logger, LOG_ERROR, "Failed to open printer device node\n");
+			return -1;
+		}
+	}
+
 	//Open input data source
 	if(input){
 		//Open file
 		debug(cfg->logger, LOG_INFO, "Opening input file at %s\n", input);
-		cfg->input_fd = open(input, O_RDONLY);
+		cfg->input.fd = open(input, O_RDONLY);
 	}
 	else{
-		cfg->input_fd = fileno(stdin);
+		cfg->input.fd = fileno(stdin);
 	}
 
-	if(cfg->input_fd < 0){
+	if(cfg->input.fd < 0){
 		debug(cfg->logger, LOG_ERROR, "Failed to open input data source\n");
 		return -1;
 	}
 
+	//Open statistics output
+	if(stats){
+		cfg->stats = strcmp(stats, "-") ? fopen(stats, "a") : stdout;
+		if(!cfg->stats){
+			debug(cfg->logger, LOG_ERROR, "Failed to open statistics output %s\n", stats);
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
-int process_data(CONF* cfg){
-	char data_buffer[DATA_BUFFER_LENGTH];
-	uint8_t line_buffer[8], current_bit = 0, current_byte = 0;
+//read from the input or the pipeline reader
+static ssize_t input_source(INPUT* input, size_t length, char* data){
+	if(input->source){
+		return ring_read(input->source, length, (uint8_t*)data);
+	}
+	return read(input->fd, data, length);
+}
+
+ssize_t input_fill(LOGGER logger, INPUT* input){
 	ssize_t bytes;
-	unsigned i;
 
-	memset(line_buffer, 0, sizeof(line_buffer));
+	if(input->offset < input->length){
+		return input->length - input->offset;
+	}
 
-	do{
-		//read data from input
-		bytes = read(cfg->input_fd, data_buffer, sizeof(data_buffer) - 1);
+	input->offset = 0;
+	input->length = 0;
+	bytes = input_source(input, sizeof(input->buffer), input->buffer);
+	if(bytes < 0){
+		debug(logger, LOG_ERROR, "input/read: %s\n", (errno == EAGAIN || errno == EWOULDBLOCK) ? "Timed out waiting for data" : strerror(errno));
+		input->failed = true;
+		return -1;
+	}
+
+	input->length = bytes;
+	input->eof = (bytes == 0);
+	return bytes;
+}
+
+ssize_t input_peek(LOGGER logger, INPUT* input, size_t length){
+	ssize_t bytes;
+
+	//move remaining data to the front of the buffer
+	if(input->offset > 0){
+		memmove(input->buffer, input->buffer + input->offset, input->length - input->offset);
+		input->length -= input->offset;
+		input->offset = 0;
+	}
 
+	while(input->length < length && input->length < sizeof(input->buffer)){
+		bytes = input_source(input, sizeof(input->buffer) - input->length, input->buffer + input->length);
 		if(bytes < 0){
-			//escape from loop
-			break;
+			debug(logger, LOG_ERROR, "input/read: %s\n", (errno == EAGAIN || errno == EWOULDBLOCK) ? "Timed out waiting for data" : strerror(errno));
+			input->failed = true;
+			return -1;
 		}
-
-		data_buffer[bytes] = 0;
-		debug(cfg->logger, LOG_DEBUG, "Current data buffer: %s\n", data_buffer);
-
-		//process
-		for(i = 0; i < bytes; i++){
-			switch(cfg->mode){
-				case MODE_BITMAP:
-					switch(data_buffer[i]){
-						case '1':
-							line_buffer[7 - current_byte] |= (0x01 << current_bit);
-						case '0':
-							current_bit++;
-							current_bit %= 8;
-							if(current_bit == 0){
-								current_byte++;
-								current_byte %= 8;
-							}
-							break;
-						case '\n':
-							debug(cfg->logger, LOG_DEBUG, "Sending bitmap raster line\n");
-							if(send_command(cfg->logger, cfg->device_fd, sizeof(PROTO_RASTERLINE) - 1, PROTO_RASTERLINE) < 0){
-								return -1;
-							}
-							if(send_command(cfg->logger, cfg->device_fd, sizeof(line_buffer), (char*)line_buffer) < 0){
-								return -1;
-							}
-
-							memset(line_buffer, 0, sizeof(line_buffer));
-							
-							//not really necessary, prevents some dumb paths though
-							current_bit = 0;
-							current_byte = 0;
-							break;
-						default:
-							debug(cfg->logger, LOG_WARNING, "Illegal character '%02X' in input stream, ignoring\n", (unsigned char)data_buffer[i]);
-					}
-					break;
-				case MODE_LINEMAP:
-					switch(data_buffer[i]){
-						case '0':
-							debug(cfg->logger, LOG_DEBUG, "Sending white raster line\n");
-							if(send_command(cfg->logger, cfg->device_fd, sizeof(PROTO_RASTERLINE_WHITE) - 1, PROTO_RASTERLINE_WHITE) < 0){
-								return -1;
-							}
-							break;
-						case '1':
-							debug(cfg->logger, LOG_DEBUG, "Sending black raster line\n");
-							if(send_command(cfg->logger, cfg->device_fd, sizeof(PROTO_RASTERLINE_BLACK) - 1, PROTO_RASTERLINE_BLACK) < 0){
-								return -1;
-							}
-							break;
-						default:
-							debug(cfg->logger, LOG_WARNING, "Illegal character '%02X' in input stream, ignoring\n", (unsigned char)data_buffer[i]);
-					}
-					break;
-				default:
-					//FIXME tcc falls through here because of some bug
-					debug(cfg->logger, LOG_ERROR, "Illegal branch, mode is %d, aborting\n", cfg->mode);
-					return -1;
-			}
-			//usleep(100);
+		if(bytes == 0){
+			input->eof = true;
+			break;
 		}
+		input->length += bytes;
 	}
-	while(bytes > 0);
-	if(bytes < 0){
-		debug(cfg->logger, LOG_ERROR, "input/read: %s\n", strerror(errno));
-		return -1;
+
+	return input->length;
+}
+
+int input_getc(LOGGER logger, INPUT* input){
+	if(input_fill(logger, input) <= 0){
+		return EOF;
 	}
-	if(cfg->print_marker){
-		debug(cfg->logger, LOG_DEBUG, "Sending label delimiter\n");
-		for(i = 0; i < 20; i++){
-			if(send_command(cfg->logger, cfg->device_fd, sizeof(PROTO_RASTERLINE_WHITE) - 1, PROTO_RASTERLINE_WHITE) < 0){
-				return -1;
-			}
-		}
-		if(send_command(cfg->logger, cfg->device_fd, sizeof(PROTO_RASTERLINE_BLACK) - 1, PROTO_RASTERLINE_BLACK) < 0){
-			return -1;
+	return (unsigned char)input->buffer[input->offset++];
+}
+
+size_t input_read(LOGGER logger, INPUT* input, size_t length, uint8_t* data){
+	size_t done = 0, chunk;
+
+	while(done < length && input_fill(logger, input) > 0){
+		chunk = input->length - input->offset;
+		if(chunk > length - done){
+			chunk = length - done;
 		}
+		memcpy(data + done, input->buffer + input->offset, chunk);
+		input->offset += chunk;
+		done += chunk;
 	}
-	return 0;
+
+	return done;
 }
 
-int main(int argc, char** argv){
-	int count;
-	unsigned i;
-	char device_buffer[(DEVICE_BUFFER_LENGTH * sizeof(PROTO_STATUS))];
-	bool print_ended = false;
-	PROTO_STATUS* status = (PROTO_STATUS*)device_buffer;
+static inline uint8_t reverse_bits(uint8_t byte){
+	return ((byte * 0x0202020202ULL) & 0x010884422010ULL) % 1023;
+}
 
+//PackBits-encode a buffer, output needs to hold at least length + (length + 127) / 128 bytes
+size_t packbits(size_t length, uint8_t* data, uint8_t* out){
+	size_t i = 0, o = 0, run, literal;
 
-	CONF cfg = {
-		.device_fd = -1,
-		.input_fd = -1,
-		.chain_print = false,
-		.print_marker = false,
-		.mode = MODE_QUERY,
-		.logger = {
-			.stream = stderr,
-			.verbosity = 1,
-			.cups_logging = false
+	while(i < length){
+		for(run = 1; i + run < length && run < 128 && data[i + run] == data[i]; run++){
 		}
-	};
 
-	//parse arguments
-	if(parse_arguments(&cfg, argc - 1, argv + 1) < 0){
-		exit(usage(argv[0]));
+		if(run > 1){
+			out[o++] = (uint8_t)(1 - (int)run);
+			out[o++] = data[i];
+			i += run;
+			continue;
+		}
+
+		//extend the literal up to the start of the next run
+		for(literal = 1; i + literal < length && literal < 128
+				&& !(i + literal + 1 < length && data[i + literal] == data[i + literal + 1]); literal++){
+		}
+		out[o++] = literal - 1;
+		memcpy(out + o, data + i, literal);
+		o += literal;
+		i += literal;
 	}
+	return o;
+}
 
-	if(cfg.device_fd < 0){
-		debug(cfg.logger, LOG_ERROR, "Failed to access the printer\n");
-		exit(usage(argv[0]));
+static const MEDIA media_table[] = {
+	{4, 24},	//3.5mm
+	{6, 32},
+	{9, 50},
+	{12, 64}
+};
+
+//encode one raster line for the selected media, pixel n of the print head maps to bit n
+size_t encode_rasterline(DEVICE* device, uint64_t pixels, bool compress, uint8_t* encoded){
+	uint8_t head[8], plain[16];
+	size_t padding = device->header_length - 3, length;
+	unsigned u;
+
+	for(u = 0; u < 8; u++){
+		head[u] = pixels >> (8 * (7 - u));
 	}
-	
-	debug(cfg.logger, LOG_DEBUG, "Status structure size %d\n", sizeof(PROTO_STATUS));
-	debug(cfg.logger, LOG_DEBUG, "Init sentence length %d\n", sizeof(PROTO_INIT));
-	debug(cfg.logger, LOG_DEBUG, "Verbosity %d\n", cfg.logger.verbosity);
 
-	//fetch device_fd data for leftovers
-	if(fetch_status(cfg.logger, cfg.device_fd, DEFAULT_ATTEMPTS, DEFAULT_TIMEOUT, sizeof(device_buffer), device_buffer) < 0){
-		return -1;
+	if(!compress){
+		memcpy(encoded, device->header, device->header_length);
+		memcpy(encoded + device->header_length, head + device->data_offset, device->data_length);
+		return device->header_length + device->data_length;
 	}
 
-	//send init command
-	if(send_command(cfg.logger, cfg.device_fd, sizeof(PROTO_INIT) - 1, PROTO_INIT) < 0){
-		return -1;
+	//padding must be transferred in compressed mode as well
+	memset(plain, 0, padding);
+	memcpy(plain + padding, head + device->data_offset, device->data_length);
+	length = packbits(padding + device->data_length, plain, encoded + 3);
+
+	//fall back to a single literal run if compression does not help
+	if(length > padding + device->data_length + 1){
+		encoded[3] = padding + device->data_length - 1;
+		memcpy(encoded + 4, plain, padding + device->data_length);
+		length = padding + device->data_length + 1;
 	}
 
-	//send status request
-	if(send_command(cfg.logger, cfg.device_fd, sizeof(PROTO_STATUS_REQUEST) - 1, PROTO_STATUS_REQUEST) < 0){
-		return -1;
+	encoded[0] = 'G';
+	encoded[1] = length & 0xFF;
+	encoded[2] = (length >> 8) & 0xFF;
+	return length + 3;
+}
+
+//select raster geometry for a media width (in mm) and precompute the line headers
+void media_select(LOGGER logger, DEVICE* device, unsigned width){
+	const MEDIA* media = media_table + (sizeof(media_table) / sizeof(media_table[0])) - 1;
+	size_t u, padding;
+
+	for(u = 0; u < sizeof(media_table) / sizeof(media_table[0]); u++){
+		if(media_table[u].width == width){
+			media = media_table + u;
+		}
 	}
 
-	//wait for status response
-	count = fetch_status(cfg.logger, cfg.device_fd, DEFAULT_ATTEMPTS, DEFAULT_TIMEOUT, sizeof(device_buffer), device_buffer);
-	if(count < 0){
-		return -1;
+	if(!width){
+		debug(logger, LOG_WARNING, "No media width reported, assuming %umm\n", media->width);
 	}
-	if(count == 0){
-		debug(cfg.logger, LOG_WARNING, "Received no status data, continuing anyway...\n");
+	else if(media->width != width){
+		debug(logger, LOG_WARNING, "Unsupported media width %umm, assuming %umm\n", width, media->width);
 	}
-	debug(cfg.logger, LOG_DEBUG, "Received %d status response structures\n", count);
 
-	if(cfg.mode == MODE_QUERY || cfg.logger.verbosity > 1){
-		//dump status record
-		print_status(count, status);
+	//printable pixels are centered on the print head
+	device->pixels = media->pixels;
+	device->pixel_offset = (64 - media->pixels) / 2;
+	device->data_offset = 7 - (device->pixel_offset + device->pixels - 1) / 8;
+	device->data_length = 7 - device->pixel_offset / 8 - device->data_offset + 1;
+
+	//the head is preceded by 4 bytes of padding, bytes outside the printable area are padding as well
+	padding = 4 + device->data_offset;
+	device->header_length = 3 + padding;
+	memset(device->header, 0, sizeof(device->header));
+	device->header[0] = 'G';
+	device->header[1] = padding + device->data_length;
+
+	for(u = 0; u < 2; u++){
+		device->black_length[u] = encode_rasterline(device, (device->pixels == 64) ? ~0ULL : (((1ULL << device->pixels) - 1) << device->pixel_offset), u, device->black[u]);
 	}
-	
-	if(cfg.mode != MODE_QUERY){
-		//switch to raster graphics mode
-		debug(cfg.logger, LOG_INFO, "Switching to raster graphics mode\n");
-		if(send_command(cfg.logger, cfg.device_fd, sizeof(PROTO_RASTER) - 1, PROTO_RASTER) < 0){
-			return -1;
-		}
+	device->cache_valid = false;
 
-		//handle input data
-		debug(cfg.logger, LOG_INFO, "Reading image data\n");
-		if(process_data(&cfg) < 0){
-			return -1;
+	debug(logger, LOG_INFO, "Using %umm media, %u printable pixels\n", media->width, media->pixels);
+}
+
+//fit a line of the given width into the printable area
+static uint64_t media_fit(DEVICE* device, uint64_t pixels, unsigned width){
+	uint64_t fitted = 0;
+	unsigned u, low, high;
+
+	if(width <= device->pixels){
+		return pixels << (device->pixel_offset + (device->pixels - width) / 2);
+	}
+
+	//scale down, every printed pixel covers a range of input pixels
+	for(u = 0; u < device->pixels; u++){
+		low = u * width / device->pixels;
+		high = (u + 1) * width / device->pixels;
+		if(pixels & (((1ULL << (high - low)) - 1) << low)){
+			fitted |= 1ULL << u;
 		}
-		
-		//flush printing buffer to tape
-		debug(cfg.logger, LOG_INFO, "Starting printer processing\n");
-		if(cfg.chain_print){
-			if(send_command(cfg.logger, cfg.device_fd, sizeof(PROTO_PRINT) - 1, PROTO_PRINT) < 0){
-				return -1;
+	}
+	return fitted << device->pixel_offset;
+}
+
+//wait for status reports until the given number of print commands has started or completed printing
+int wait_printer(LOGGER logger, DEVICE* device, unsigned prints, bool started, unsigned timeout){
+	char device_buffer[(DEVICE_BUFFER_LENGTH * sizeof(PROTO_STATUS))];
+	uint64_t start = monotonic_us();
+	int count, rv = 0;
+
+	while(device->completed < prints && !(started && device->started >= prints)){
+		//every status report restarts the deadline, as long labels take a while
+		count = fetch_status(logger, device, timeout, sizeof(device_buffer), device_buffer);
+		if(count < 0){
+			rv = -1;
+			break;
+		}
+
+		if(count == 0){
+			if(started){
+				debug(logger, LOG_DEBUG, "No phase change reported, continuing\n");
 			}
+			else{
+				debug(logger, LOG_WARNING, "Received no status data, printer may have encountered an error or still be printing\n");
+			}
+			break;
 		}
-		else{
-			if(send_command(cfg.logger, cfg.device_fd, sizeof(PROTO_PRINT_FEED) - 1, PROTO_PRINT_FEED) < 0){
+		debug(logger, LOG_DEBUG, "Received %d status response structures\n", count);
+
+		if(handle_status(logger, device, count, (PROTO_STATUS*)device_buffer) < 0){
+			rv = -1;
+			break;
+		}
+	}
+
+	device->stats.phase_us[PHASE_PRINT] += monotonic_us() - start;
+	return rv;
+}
+
+//print the raster data buffered in the printer, chaining to the following data unless feeding for a cut
+int print_segment(LOGGER logger, DEVICE* device, bool feed){
+	//the printer accepts the next print command only after finishing the previous one
+	if(device->prints > 0 && wait_printer(logger, device, device->prints, false, DEFAULT_PRINT_TIMEOUT) < 0){
+		return -1;
+	}
+
+	if(feed){
+		if(send_command(logger, device, sizeof(PROTO_PRINT_FEED) - 1, PROTO_PRINT_FEED) < 0){
+			return -1;
+		}
+	}
+	else if(send_command(logger, device, sizeof(PROTO_PRINT) - 1, PROTO_PRINT) < 0){
+		return -1;
+	}
+
+	//print commands are the only point where the device is synchronized
+	if(device_flush(logger, device, true) < 0){
+		return -1;
+	}
+	device->prints++;
+	device->segment_lines = 0;
+	return 0;
+}
+
+//account for a raster line queued in the printer, printing the buffered segment of long labels first
+static int segment_line(LOGGER logger, DEVICE* device){
+	if(device->segment_limit && device->segment_lines >= device->segment_limit){
+		debug(logger, LOG_INFO, "Label exceeds %zu raster lines, printing chained segment %u\n", device->segment_limit, device->prints + 1);
+		if(print_segment(logger, device, false) < 0){
+			return -1;
+		}
+
+		//the next segment is transferred while this one prints, so two segments share the printer buffer
+		if(wait_printer(logger, device, device->prints, true, DEFAULT_TIMEOUT) < 0){
+			return -1;
+		}
+	}
+	device->segment_lines++;
+	return 0;
+}
+
+int send_rasterline_white(LOGGER logger, DEVICE* device){
+	if(segment_line(logger, device) < 0){
+		return -1;
+	}
+
+	debug(logger, LOG_DEBUG, "Sending white raster line\n");
+	device->stats.lines_white++;
+	device->raster_plain += device->header_length + device->data_length;
+	device->raster_sent += sizeof(PROTO_RASTERLINE_WHITE) - 1;
+	return send_command(logger, device, sizeof(PROTO_RASTERLINE_WHITE) - 1, PROTO_RASTERLINE_WHITE);
+}
+
+//send a raster line of up to 64 pixels, pixel n is stored in bit n % 8 of line[7 - n / 8]
+int send_rasterline(LOGGER logger, DEVICE* device, uint8_t* line, unsigned width){
+	uint64_t pixels = 0;
+	unsigned u;
+
+	for(u = 0; u < 8; u++){
+		pixels |= ((uint64_t)line[u]) << (8 * (7 - u));
+	}
+
+	if(width != 64 || device->pixels != 64){
+		pixels = media_fit(device, pixels, width);
+	}
+
+	//all-white lines have a width-independent shorthand
+	if(!pixels){
+		return send_rasterline_white(logger, device);
+	}
+
+	if(segment_line(logger, device) < 0){
+		return -1;
+	}
+
+	device->raster_plain += device->header_length + device->data_length;
+	device->stats.lines_raster++;
+
+	//repeated lines are sent from the cached encoding
+	if(device->cache_valid && device->cache_line == pixels){
+		debug(logger, LOG_DEBUG, "Sending cached bitmap raster line\n");
+		device->raster_sent += device->cache_length;
+		return send_command(logger, device, device->cache_length, (char*)device->cache_encoded);
+	}
+
+	debug(logger, LOG_DEBUG, "Sending bitmap raster line\n");
+	device->cache_length = encode_rasterline(device, pixels, device->compress, device->cache_encoded);
+	device->cache_line = pixels;
+	device->cache_valid = true;
+
+	device->raster_sent += device->cache_length;
+	return send_command(logger, device, device->cache_length, (char*)device->cache_encoded);
+}
+
+int send_rasterline_black(LOGGER logger, DEVICE* device){
+	if(segment_line(logger, device) < 0){
+		return -1;
+	}
+
+	debug(logger, LOG_DEBUG, "Sending black raster line\n");
+	device->stats.lines_raster++;
+	device->raster_plain += device->header_length + device->data_length;
+	device->raster_sent += device->black_length[device->compress];
+	return send_command(logger, device, device->black_length[device->compress], (char*)device->black[device->compress]);
+}
+
+//pack 64 ASCII '0'/'1' characters into one raster line, fails on any other character
+static inline bool pack_ascii_line(const char* data, uint8_t* line){
+	uint64_t mask = 0;
+	unsigned u;
+#if defined(__AVX2__)
+	__m256i zero = _mm256_set1_epi8('0'), one = _mm256_set1_epi8('1');
+	for(u = 0; u < 2; u++){
+		__m256i chunk = _mm256_loadu_si256((const __m256i*)(data + 32 * u));
+		uint32_t ones = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, one));
+		uint32_t zeros = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero));
+		if((ones | zeros) != 0xFFFFFFFF){
+			return false;
+		}
+		mask |= ((uint64_t)ones) << (32 * u);
+	}
+#elif defined(__SSE2__)
+	__m128i zero = _mm_set1_epi8('0'), one = _mm_set1_epi8('1');
+	for(u = 0; u < 4; u++){
+		__m128i chunk = _mm_loadu_si128((const __m128i*)(data + 16 * u));
+		uint32_t ones = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, one));
+		uint32_t zeros = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+		if((ones | zeros) != 0xFFFF){
+			return false;
+		}
+		mask |= ((uint64_t)ones) << (16 * u);
+	}
+#else
+	unsigned b;
+	for(u = 0; u < 8; u++){
+		uint64_t chunk = 0;
+		for(b = 0; b < 8; b++){
+			chunk |= ((uint64_t)(uint8_t)data[8 * u + b]) << (8 * b);
+		}
+		//every byte must be either 0x30 or 0x31
+		if((chunk & 0xFEFEFEFEFEFEFEFEULL) != 0x3030303030303030ULL){
+			return false;
+		}
+		//gather the low bit of every byte into one byte, first character to LSB
+		mask |= (((chunk & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56) << (8 * u);
+	}
+#endif
+	//pixel n maps to bit n % 8 of byte 7 - n / 8
+	for(u = 0; u < 8; u++){
+		line[7 - u] = mask >> (8 * u);
+	}
+	return true;
+}
+
+int process_ascii(CONF* cfg){
+	uint8_t line_buffer[8], current_bit = 0, current_byte = 0;
+	INPUT* input = &(cfg->input);
+	unsigned pixels = 0;
+	size_t i;
+
+	memset(line_buffer, 0, sizeof(line_buffer));
+
+	while(input_fill(cfg->logger, input) > 0){
+		//make sure a complete line is buffered when starting one
+		if(pixels == 0 && input->length - input->offset <= 64 && !input->eof){
+			if(input_peek(cfg->logger, input, 65) < 0){
 				return -1;
 			}
 		}
+		i = input->offset;
 
-		//wait until printer is done
-		debug(cfg.logger, LOG_INFO, "Waiting for printer to finish\n");
-		
-		while(!print_ended){
-			count = fetch_status(cfg.logger, cfg.device_fd, -1, 5000, sizeof(device_buffer), device_buffer);
-			if(count < 0){
+		//fast path for complete lines of 64 pixels
+		if(pixels == 0 && input->length - i > 64 && input->buffer[i + 64] == '\n'
+				&& pack_ascii_line(input->buffer + i, line_buffer)){
+			if(send_rasterline(cfg->logger, &(cfg->device), line_buffer, 64) < 0){
 				return -1;
 			}
-			
-			if(count == 0){
-				debug(cfg.logger, LOG_WARNING, "Received no status data, printer may have encountered an error or still be printing\n");
+			memset(line_buffer, 0, sizeof(line_buffer));
+			input->offset = i + 65;
+			continue;
+		}
+
+		switch(input->buffer[i]){
+			case '1':
+				line_buffer[7 - current_byte] |= (0x01 << current_bit);
+			case '0':
+				pixels++;
+				current_bit++;
+				current_bit %= 8;
+				if(current_bit == 0){
+					current_byte++;
+					current_byte %= 8;
+				}
+				break;
+			case '\n':
+				if(send_rasterline(cfg->logger, &(cfg->device), line_buffer, (pixels > 0 && pixels < 64) ? pixels : 64) < 0){
+					return -1;
+				}
+
+				memset(line_buffer, 0, sizeof(line_buffer));
+
+				//not really necessary, prevents some dumb paths though
+				current_bit = 0;
+				current_byte = 0;
+				pixels = 0;
 				break;
+			case '\f':
+				//label delimiter
+				input->offset = i + 1;
+				return 1;
+			default:
+				debug(cfg->logger, LOG_WARNING, "Illegal character '%02X' in input stream, ignoring\n", (unsigned char)input->buffer[i]);
+		}
+		input->offset = i + 1;
+	}
+	return 0;
+}
+
+//build the raster line for a black bar of the configured geometry, returns false for full-width bars
+bool bar_template(CONF* cfg, uint8_t* line){
+	unsigned height = cfg->bars.height, offset = cfg->bars.offset, u;
+	uint64_t pixels;
+
+	if(!height || (!offset && height >= cfg->device.pixels)){
+		return false;
+	}
+
+	if(offset >= cfg->device.pixels){
+		debug(cfg->logger, LOG_WARNING, "Bar offset exceeds printable width of %u pixels\n", cfg->device.pixels);
+		offset = cfg->device.pixels;
+	}
+	if(offset + height > cfg->device.pixels){
+		debug(cfg->logger, LOG_WARNING, "Clipping bars to printable width of %u pixels\n", cfg->device.pixels);
+		height = cfg->device.pixels - offset;
+	}
+
+	pixels = (height >= 64) ? ~0ULL : ((1ULL << height) - 1);
+	pixels <<= offset;
+	for(u = 0; u < 8; u++){
+		line[u] = pixels >> (8 * (7 - u));
+	}
+	return true;
+}
+
+//send a bar of the configured width, the template is encoded once and repeated from the line cache
+int send_bar(CONF* cfg, bool black, uint8_t* template){
+	unsigned width = cfg->bars.width ? cfg->bars.width : 1, u;
+	int rv = 0;
+
+	for(u = 0; u < width && rv == 0; u++){
+		if(!black){
+			rv = send_rasterline_white(cfg->logger, &(cfg->device));
+		}
+		else if(template){
+			rv = send_rasterline(cfg->logger, &(cfg->device), template, cfg->device.pixels);
+		}
+		else{
+			rv = send_rasterline_black(cfg->logger, &(cfg->device));
+		}
+	}
+	return rv;
+}
+
+int process_linemap(CONF* cfg){
+	INPUT* input = &(cfg->input);
+	uint8_t line_buffer[8];
+	uint8_t* template = bar_template(cfg, line_buffer) ? line_buffer : NULL;
+	size_t i;
+
+	while(input_fill(cfg->logger, input) > 0){
+		for(i = input->offset; i < input->length; i++){
+			switch(input->buffer[i]){
+				case '0':
+				case '1':
+					if(send_bar(cfg, input->buffer[i] == '1', template) < 0){
+						return -1;
+					}
+					break;
+				case '\f':
+					//label delimiter
+					input->offset = i + 1;
+					return 1;
+				default:
+					debug(cfg->logger, LOG_WARNING, "Illegal character '%02X' in input stream, ignoring\n", (unsigned char)input->buffer[i]);
 			}
-			else{
-				debug(cfg.logger, LOG_DEBUG, "Received %d status response structures\n", count);
+		}
+		input->offset = input->length;
+	}
+	return 0;
+}
+
+int process_packed(CONF* cfg){
+	uint8_t line_buffer[8];
+	size_t bytes;
+
+	//raw packed input is already in device byte order
+	while((bytes = input_read(cfg->logger, &(cfg->input), sizeof(line_buffer), line_buffer)) == sizeof(line_buffer)){
+		if(send_rasterline(cfg->logger, &(cfg->device), line_buffer, 64) < 0){
+			return -1;
+		}
+	}
+
+	if(bytes != 0){
+		debug(cfg->logger, LOG_WARNING, "Ignoring %zu trailing bytes of incomplete raster line\n", bytes);
+	}
+	return 0;
+}
+
+//read one unsigned decimal header field from a PBM file, skipping whitespace and comments
+long pbm_header_field(LOGGER logger, INPUT* input){
+	int c;
+	long value = -1;
+
+	for(c = input_getc(logger, input); c != EOF; c = input_getc(logger, input)){
+		if(c == '#'){
+			for(; c != EOF && c != '\n'; c = input_getc(logger, input)){
+			}
+			continue;
+		}
+		if(c >= '0' && c <= '9'){
+			value = (value < 0) ? 0 : value;
+			value = value * 10 + (c - '0');
+			continue;
+		}
+		//whitespace terminates a field
+		if(value >= 0){
+			break;
+		}
+	}
+	return value;
+}
+
+int process_pbm(CONF* cfg){
+	uint8_t row[DATA_BUFFER_LENGTH], line_buffer[8];
+	long width, height, row_bytes, line;
+	size_t u;
+
+	//skip magic
+	cfg->input.offset += 2;
+	width = pbm_header_field(cfg->logger, &(cfg->input));
+	height = pbm_header_field(cfg->logger, &(cfg->input));
+	if(width <= 0 || height < 0){
+		debug(cfg->logger, LOG_ERROR, "Invalid PBM header\n");
+		return -1;
+	}
+
+	row_bytes = (width + 7) / 8;
+	if(row_bytes > sizeof(row)){
+		debug(cfg->logger, LOG_ERROR, "PBM width %ld not supported\n", width);
+		return -1;
+	}
+	if(width > 64){
+		debug(cfg->logger, LOG_WARNING, "PBM width %ld exceeds printable width, truncating\n", width);
+	}
+	debug(cfg->logger, LOG_INFO, "Reading %ldx%ld PBM image\n", width, height);
+
+	for(line = 0; line < height; line++){
+		if(input_read(cfg->logger, &(cfg->input), row_bytes, row) != row_bytes){
+			debug(cfg->logger, LOG_WARNING, "PBM data ended prematurely after %ld lines\n", line);
+			break;
+		}
+
+		//mask padding bits of the last byte
+		if(width < 64 && width % 8){
+			row[width / 8] &= 0xFF << (8 - (width % 8));
+		}
+
+		//PBM maps the leftmost pixel to the MSB of the first byte
+		memset(line_buffer, 0, sizeof(line_buffer));
+		for(u = 0; u < 8 && u < row_bytes; u++){
+			line_buffer[7 - u] = reverse_bits(row[u]);
+		}
+
+		if(send_rasterline(cfg->logger, &(cfg->device), line_buffer, (width < 64) ? width : 64) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int process_xbm(CONF* cfg){
+	char token[DATA_BUFFER_LENGTH], name[DATA_BUFFER_LENGTH];
+	uint8_t line_buffer[8];
+	unsigned long value, width = 0, height = 0;
+	size_t length = 0, row_bytes, column = 0;
+	int c;
+
+	//parse #define lines up to the start of the data array
+	for(c = input_getc(cfg->logger, &(cfg->input)); c != EOF && c != '{'; c = input_getc(cfg->logger, &(cfg->input))){
+		if(c != '\n' && length < sizeof(token) - 1){
+			token[length++] = c;
+			continue;
+		}
+
+		token[length] = 0;
+		length = 0;
+		if(sscanf(token, "#define %s %lu", name, &value) == 2){
+			if(strlen(name) >= 6 && !strcmp(name + strlen(name) - 6, "_width")){
+				width = value;
 			}
-		
-			if(cfg.logger.verbosity >= LOG_DEBUG){
-				print_status(count, status);
+			else if(strlen(name) >= 7 && !strcmp(name + strlen(name) - 7, "_height")){
+				height = value;
 			}
+		}
+	}
+
+	if(c == EOF || width == 0){
+		debug(cfg->logger, LOG_ERROR, "Invalid XBM header\n");
+		return -1;
+	}
+	if(width > 64){
+		debug(cfg->logger, LOG_WARNING, "XBM width %lu exceeds printable width, truncating\n", width);
+	}
+	debug(cfg->logger, LOG_INFO, "Reading %lux%lu XBM image\n", width, height);
 
-			for(i = 0; i < count; i++){
-				switch(status[i].status){
-					case 0x00:
-						//status request response
-						//should not happen here, if it does anyway, ignore it
-						break;
-					case 0x01:
-						debug(cfg.logger, LOG_INFO, "Printing completed successfully\n");
-						print_ended = true;
-						break;
-					case 0x02:
-						debug(cfg.logger, LOG_ERROR, "Device reported an error, status dump follows\n");
-						print_status(1, status + i);
-						print_ended = true;
-						break;
-					case 0x06:
-						debug(cfg.logger, LOG_DEBUG, "Phase change\n");
-						break;
+	row_bytes = (width + 7) / 8;
+	memset(line_buffer, 0, sizeof(line_buffer));
+	length = 0;
+
+	//parse hex values, XBM maps the leftmost pixel to the LSB of the first byte
+	for(c = input_getc(cfg->logger, &(cfg->input)); c != EOF; c = input_getc(cfg->logger, &(cfg->input))){
+		if(isxdigit(c) || c == 'x' || c == 'X'){
+			if(length < sizeof(token) - 1){
+				token[length++] = c;
+			}
+			continue;
+		}
+
+		if(length > 0){
+			token[length] = 0;
+			length = 0;
+			value = strtoul(token, NULL, 16);
+			if(column < 8){
+				line_buffer[7 - column] = value;
+			}
+			column++;
+
+			if(column == row_bytes){
+				if(width < 64 && width % 8){
+					line_buffer[7 - (width / 8)] &= 0xFF >> (8 - (width % 8));
 				}
+				if(send_rasterline(cfg->logger, &(cfg->device), line_buffer, (width < 64) ? width : 64) < 0){
+					return -1;
+				}
+				memset(line_buffer, 0, sizeof(line_buffer));
+				column = 0;
 			}
 		}
+
+		if(c == '}'){
+			break;
+		}
 	}
 
-	//clean up
-	close(cfg.device_fd);
-	if(cfg.input_fd > 0){
-		close(cfg.input_fd);
+	if(column != 0){
+		debug(cfg->logger, LOG_WARNING, "XBM data ended within a raster line\n");
+	}
+
+	//consume the rest of the declaration (usually "};"), following whitespace is skipped by input_more
+	if(c == '}'){
+		while(input_fill(cfg->logger, &(cfg->input)) > 0){
+			c = cfg->input.buffer[cfg->input.offset];
+			if(!isspace(c) && c != ';'){
+				break;
+			}
+			cfg->input.offset++;
+			if(c == ';'){
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+BITMAP_FORMAT detect_format(CONF* cfg){
+	if(input_peek(cfg->logger, &(cfg->input), 7) < 0){
+		return FORMAT_ASCII;
+	}
+
+	if(cfg->input.length >= 2 && !memcmp(cfg->input.buffer, "P4", 2)){
+		return FORMAT_PBM;
+	}
+
+	if(cfg->input.length >= 7 && !memcmp(cfg->input.buffer, "#define", 7)){
+		return FORMAT_XBM;
+	}
+
+	if(cfg->input.length >= 4 && (!memcmp(cfg->input.buffer, "RaS", 3) || !memcmp(cfg->input.buffer + 1, "SaR", 3))){
+		return FORMAT_CUPS;
+	}
+
+	return FORMAT_ASCII;
+}
+
+//check whether there is more than whitespace left in the input
+int input_more(CONF* cfg){
+	INPUT* input = &(cfg->input);
+
+	while(input_fill(cfg->logger, input) > 0){
+		if(!isspace(input->buffer[input->offset])){
+			return 1;
+		}
+		input->offset++;
+	}
+	return input->failed ? -1 : 0;
+}
+
+//text given on the command line, or the complete input without trailing newlines
+char* input_text(CONF* cfg){
+	char* text = NULL;
+	size_t length = 0, bytes;
+
+	if(cfg->text){
+		return cfg->text;
+	}
+
+	do{
+		text = realloc(text, length + DATA_BUFFER_LENGTH + 1);
+		if(!text){
+			debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+			return NULL;
+		}
+		bytes = input_read(cfg->logger, &(cfg->input), DATA_BUFFER_LENGTH, (uint8_t*)text + length);
+		length += bytes;
+	} while(bytes == DATA_BUFFER_LENGTH);
+	text[length] = 0;
+
+	for(; length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r'); length--){
+		text[length - 1] = 0;
+	}
+	return text;
+}
+
+//render a text label directly into raster lines
+int process_text(CONF* cfg){
+	char** lines = NULL;
+	char* text = input_text(cfg);
+	uint64_t* framebuffer;
+	size_t raster_lines, u;
+	uint8_t line_buffer[8];
+	unsigned i;
+	int rv = 0;
+
+	if(!text){
+		return -1;
+	}
+
+	if(text_split(text, &lines) < 0){
+		rv = -1;
+	}
+	if(text != cfg->text){
+		free(text);
+	}
+	if(rv < 0){
+		return -1;
+	}
+
+	debug(cfg->logger, LOG_INFO, "Rendering %zu lines of text at %u pixels\n", stored_lines(lines), cfg->device.pixels);
+	framebuffer = text_render(&(cfg->renderer), lines, cfg->device.pixels, &raster_lines);
+	text_free_lines(lines);
+	if(!framebuffer){
+		debug(cfg->logger, LOG_ERROR, "Failed to render text\n");
+		return -1;
+	}
+
+	//the printable area never exceeds one framebuffer word
+	for(u = 0; u < raster_lines; u++){
+		for(i = 0; i < 8; i++){
+			line_buffer[i] = framebuffer[u] >> (8 * (7 - i));
+		}
+		if(send_rasterline(cfg->logger, &(cfg->device), line_buffer, cfg->device.pixels) < 0){
+			rv = -1;
+			break;
+		}
+	}
+
+	free(framebuffer);
+	return rv;
+}
+
+//encode a 2D symbol at the largest integer module size fitting the printable width
+int process_matrix(CONF* cfg, char* data){
+	uint8_t modules[MATRIX_MAX_SIZE * MATRIX_MAX_SIZE], line_buffer[8];
+	unsigned module_size, quiet, x, u;
+	uint64_t pixels;
+	ssize_t size;
+
+	size = matrix_encode(cfg->logger, cfg->symbology, data, modules);
+	if(size < 0){
+		return -1;
+	}
+
+	module_size = cfg->device.pixels / size;
+	if(!module_size){
+		debug(cfg->logger, LOG_ERROR, "Symbol of %zd modules exceeds printable width of %u pixels\n", size, cfg->device.pixels);
+		return -1;
+	}
+	debug(cfg->logger, LOG_INFO, "Encoded %s symbol of %zdx%zd modules at %u pixels per module\n",
+			barcode_symbology_name(cfg->symbology), size, size, module_size);
+
+	//the tape margins provide the quiet zone across the tape, only the length needs padding
+	quiet = matrix_quiet_zone(cfg->symbology) * module_size;
+	for(u = 0; u < quiet; u++){
+		if(send_rasterline_white(cfg->logger, &(cfg->device)) < 0){
+			return -1;
+		}
+	}
+
+	//each module column is one raster line, repeated from the line cache, with the top row at the far edge
+	for(x = 0; x < size; x++){
+		pixels = matrix_column(modules, size, x, module_size);
+		for(u = 0; u < 8; u++){
+			line_buffer[u] = pixels >> (8 * (7 - u));
+		}
+		for(u = 0; u < module_size; u++){
+			if(send_rasterline(cfg->logger, &(cfg->device), line_buffer, size * module_size) < 0){
+				return -1;
+			}
+		}
+	}
+
+	for(u = 0; u < quiet; u++){
+		if(send_rasterline_white(cfg->logger, &(cfg->device)) < 0){
+			return -1;
+		}
 	}
 	return 0;
 }
+
+//encode a barcode directly into bars of the configured geometry
+int process_barcode(CONF* cfg){
+	uint8_t modules[BARCODE_MAX_MODULES], line_buffer[8];
+	uint8_t* template = bar_template(cfg, line_buffer) ? line_buffer : NULL;
+	char* data = input_text(cfg);
+	unsigned width = cfg->bars.width;
+	ssize_t count, u;
+
+	if(!data){
+		return -1;
+	}
+
+	if(matrix_symbology(cfg->symbology)){
+		count = process_matrix(cfg, data);
+		if(data != cfg->text){
+			free(data);
+		}
+		return count;
+	}
+
+	count = barcode_encode(cfg->logger, cfg->symbology, data, sizeof(modules), modules);
+	if(data != cfg->text){
+		free(data);
+	}
+	if(count < 0){
+		return -1;
+	}
+
+	//single raster line modules are too narrow to scan reliably
+	cfg->bars.width = width ? width : BARCODE_MODULE_WIDTH;
+	debug(cfg->logger, LOG_INFO, "Encoded %s barcode of %zd modules\n", barcode_symbology_name(cfg->symbology), count);
+	for(u = 0; u < count; u++){
+		if(send_bar(cfg, modules[u], template) < 0){
+			cfg->bars.width = width;
+			return -1;
+		}
+	}
+	cfg->bars.width = width;
+	return 0;
+}
+
+//read the name=value field assignments of one label, returns 1 if a label delimiter was found
+static int template_read_fields(CONF* cfg){
+	char line[DATA_BUFFER_LENGTH];
+	size_t length = 0;
+	int c;
+
+	template_clear_fields(&(cfg->template));
+	while(true){
+		c = input_getc(cfg->logger, &(cfg->input));
+		if(c == EOF || c == '\n' || c == '\f'){
+			for(; length > 0 && line[length - 1] == '\r'; length--){
+			}
+			line[length] = 0;
+			if(length && template_field(cfg, line) < 0){
+				return -1;
+			}
+			//labels end with a form feed or an empty line
+			if(c == EOF || c == '\f' || (c == '\n' && !length && cfg->template.fields)){
+				return (c == EOF) ? 0 : 1;
+			}
+			length = 0;
+			continue;
+		}
+		if(length >= sizeof(line) - 1){
+			debug(cfg->logger, LOG_ERROR, "Template field assignment too long\n");
+			return -1;
+		}
+		line[length++] = c;
+	}
+}
+
+//render a template label, only the variable elements are rendered per label
+int process_template(CONF* cfg){
+	uint64_t* framebuffer;
+	uint8_t line_buffer[8];
+	size_t length, u;
+	unsigned i;
+	int rv = 0;
+
+	//a running batch pins the template its workers render from, it is neither reloaded nor re-rendered
+	if(!cfg->batch && template_prepare(cfg) < 0){
+		return -1;
+	}
+
+	//CSV batches are rendered ahead by worker threads
+	if(cfg->csv){
+		rv = batch_next(cfg, &(cfg->template), &framebuffer, &length);
+		if(rv < 0){
+			return -1;
+		}
+	}
+	else{
+		//templates without fields do not consume input
+		if(cfg->template.variable){
+			rv = template_read_fields(cfg);
+			if(rv < 0 || cfg->input.failed){
+				return -1;
+			}
+		}
+
+		framebuffer = template_render(cfg, &length);
+		if(!framebuffer){
+			return -1;
+		}
+	}
+
+	debug(cfg->logger, LOG_INFO, "Rendered template label of %zu raster lines\n", length);
+	for(u = 0; u < length; u++){
+		for(i = 0; i < 8; i++){
+			line_buffer[i] = framebuffer[u] >> (8 * (7 - i));
+		}
+		if(send_rasterline(cfg->logger, &(cfg->device), line_buffer, cfg->device.pixels) < 0){
+			rv = -1;
+			break;
+		}
+	}
+
+	free(framebuffer);
+	return rv;
+}
+
+//process one label, returns 1 if more labels follow
+int process_data(CONF* cfg){
+	unsigned i;
+	int rv = 0;
+
+	switch(cfg->mode){
+		case MODE_BITMAP:
+			//binary images are simply concatenated, CUPS raster pages follow their stream header
+			switch(cfg->raster.version ? FORMAT_CUPS : detect_format(cfg)){
+				case FORMAT_CUPS:
+					rv = process_cups(cfg);
+					break;
+				case FORMAT_PBM:
+					debug(cfg->logger, LOG_INFO, "Detected PBM input\n");
+					rv = process_pbm(cfg);
+					rv = (rv < 0) ? rv : 1;
+					break;
+				case FORMAT_XBM:
+					debug(cfg->logger, LOG_INFO, "Detected XBM input\n");
+					rv = process_xbm(cfg);
+					rv = (rv < 0) ? rv : 1;
+					break;
+				default:
+					rv = process_ascii(cfg);
+			}
+			break;
+		case MODE_LINEMAP:
+			rv = process_linemap(cfg);
+			break;
+		case MODE_PACKED:
+			rv = process_packed(cfg);
+			break;
+		case MODE_TEXT:
+			rv = process_text(cfg);
+			break;
+		case MODE_BARCODE:
+			rv = process_barcode(cfg);
+			break;
+		case MODE_TEMPLATE:
+			rv = process_template(cfg);
+			break;
+		default:
+			//FIXME tcc falls through here because of some bug
+			debug(cfg->logger, LOG_ERROR, "Illegal branch, mode is %d, aborting\n", cfg->mode);
+			return -1;
+	}
+
+	if(rv < 0 || cfg->input.failed){
+		return -1;
+	}
+
+	if(cfg->print_marker){
+		debug(cfg->logger, LOG_DEBUG, "Sending label delimiter\n");
+		for(i = 0; i < 20; i++){
+			if(send_rasterline_white(cfg->logger, &(cfg->device)) < 0){
+				return -1;
+			}
+		}
+		if(send_rasterline_black(cfg->logger, &(cfg->device)) < 0){
+			return -1;
+		}
+	}
+
+	//CSV batches and CUPS raster streams track the remaining labels themselves
+	if((cfg->mode == MODE_TEMPLATE && cfg->csv) || cfg->raster.version){
+		return rv;
+	}
+
+	//labels in ASCII formats are separated by form feeds
+	return (rv > 0) ? input_more(cfg) : 0;
+}
+
+int printer_init(CONF* cfg, size_t buffer_length, char* buffer){
+	uint64_t start;
+	int count;
+
+	//fetch device data for leftovers
+	start = monotonic_us();
+	if(fetch_status(cfg->logger, &(cfg->device), 0, buffer_length, buffer) < 0){
+		return -1;
+	}
+	cfg->device.stats.phase_us[PHASE_DRAIN] += monotonic_us() - start;
+
+	//send init command
+	start = monotonic_us();
+	if(send_command(cfg->logger, &(cfg->device), sizeof(PROTO_INIT) - 1, PROTO_INIT) < 0){
+		return -1;
+	}
+
+	//send status request
+	if(send_command(cfg->logger, &(cfg->device), sizeof(PROTO_STATUS_REQUEST) - 1, PROTO_STATUS_REQUEST) < 0
+			|| device_flush(cfg->logger, &(cfg->device), false) < 0){
+		return -1;
+	}
+	cfg->device.stats.phase_us[PHASE_INIT] += monotonic_us() - start;
+
+	//wait for status response
+	start = monotonic_us();
+	count = fetch_status(cfg->logger, &(cfg->device), DEFAULT_TIMEOUT, buffer_length, buffer);
+	if(count < 0){
+		return -1;
+	}
+	cfg->device.stats.phase_us[PHASE_STATUS] += monotonic_us() - start;
+	if(count == 0){
+		debug(cfg->logger, LOG_WARNING, "Received no status data, continuing anyway...\n");
+		//without status reports, the printer buffer can not be tracked
+		if(cfg->device.segment_limit){
+			debug(cfg->logger, LOG_INFO, "Long labels will not be split into segments\n");
+			cfg->device.segment_limit = 0;
+		}
+	}
+	else{
+		cfg->device.status = ((PROTO_STATUS*)buffer)[count - 1];
+	}
+	debug(cfg->logger, LOG_DEBUG, "Received %d status response structures\n", count);
+
+	media_select(cfg->logger, &(cfg->device), cfg->media_width ? cfg->media_width : cfg->device.status.media_width);
+	return count;
+}
+
+//time elapsed since start, not counting the time spent waiting on the printer since then
+static uint64_t transfer_time(DEVICE* device, uint64_t start, uint64_t print_start){
+	return monotonic_us() - start - (device->stats.phase_us[PHASE_PRINT] - print_start);
+}
+
+static int print_labels(CONF* cfg){
+	unsigned labels = 0, syscalls;
+	uint64_t start, print_start;
+	int more;
+
+	cfg->device.started = 0;
+	cfg->device.completed = 0;
+	cfg->device.prints = 0;
+	cfg->device.segment_lines = 0;
+
+	//switch to raster graphics mode
+	debug(cfg->logger, LOG_INFO, "Switching to raster graphics mode\n");
+	if(send_command(cfg->logger, &(cfg->device), sizeof(PROTO_RASTER) - 1, PROTO_RASTER) < 0){
+		return -1;
+	}
+
+	if(cfg->device.compress){
+		debug(cfg->logger, LOG_INFO, "Enabling raster compression\n");
+		if(send_command(cfg->logger, &(cfg->device), sizeof(PROTO_COMPRESSION) - 1, PROTO_COMPRESSION) < 0){
+			return -1;
+		}
+	}
+
+	do{
+		//transfer the next label once the previous one has started printing
+		if(cfg->device.prints > 0 && wait_printer(cfg->logger, &(cfg->device), cfg->device.prints, true, DEFAULT_TIMEOUT) < 0){
+			return -1;
+		}
+
+		//handle input data, long labels are printed in chained segments while transferring
+		debug(cfg->logger, LOG_INFO, "Reading image data for label %u\n", labels + 1);
+		syscalls = cfg->device.syscalls;
+		start = monotonic_us();
+		print_start = cfg->device.stats.phase_us[PHASE_PRINT];
+		more = process_data(cfg);
+		cfg->device.stats.phase_us[PHASE_TRANSFER] += transfer_time(&(cfg->device), start, print_start);
+		if(more < 0){
+			return -1;
+		}
+
+		//flush printing buffer to tape, chaining labels within the job
+		debug(cfg->logger, LOG_INFO, "Starting printer processing\n");
+		start = monotonic_us();
+		print_start = cfg->device.stats.phase_us[PHASE_PRINT];
+		if(print_segment(cfg->logger, &(cfg->device), !(more || cfg->chain_print)) < 0){
+			return -1;
+		}
+		cfg->device.stats.phase_us[PHASE_TRANSFER] += transfer_time(&(cfg->device), start, print_start);
+		labels++;
+
+		//with pipelined transfer, writes still queued are attributed to the following label
+		syscalls = cfg->device.syscalls - syscalls;
+		debug(cfg->logger, LOG_INFO, "Label %u used %u device syscalls\n", labels, syscalls);
+		if(syscalls > cfg->device.stats.label_syscalls){
+			cfg->device.stats.label_syscalls = syscalls;
+		}
+	} while(more);
+
+	if(cfg->device.raster_sent){
+		debug(cfg->logger, LOG_INFO, "Compression ratio %.2f (%zu raster bytes sent, %zu uncompressed)\n",
+				(double)cfg->device.raster_plain / cfg->device.raster_sent, cfg->device.raster_sent, cfg->device.raster_plain);
+	}
+
+	//wait until printer is done
+	debug(cfg->logger, LOG_INFO, "Waiting for printer to finish %u labels\n", labels);
+	return wait_printer(cfg->logger, &(cfg->device), cfg->device.prints, false, DEFAULT_PRINT_TIMEOUT);
+}
+
+int print_job(CONF* cfg){
+	int rv;
+
+	if(!cfg->pipelined){
+		return print_labels(cfg);
+	}
+
+	//reading, encoding and transferring run concurrently for the duration of the job
+	rv = pipeline_start(cfg);
+	if(!rv){
+		rv = print_labels(cfg);
+	}
+	pipeline_stop(cfg);
+	return rv;
+}
+
+//emit statistics for the last job as a single JSON record, then start counting anew
+void stats_report(CONF* cfg, int result){
+	static char* phase_names[] = {
+		[PHASE_OPEN] = "open",
+		[PHASE_DRAIN] = "drain",
+		[PHASE_INIT] = "init",
+		[PHASE_STATUS] = "status",
+		[PHASE_TRANSFER] = "transfer",
+		[PHASE_PRINT] = "print"
+	};
+	STATS* stats = &(cfg->device.stats);
+	unsigned u;
+
+	if(cfg->stats){
+		//spooler threads share the statistics output
+		flockfile(cfg->stats);
+		fprintf(cfg->stats, "{\"result\": \"%s\", \"labels_completed\": %u, \"phases_us\": {", (result < 0) ? "error" : "ok", cfg->device.completed);
+		for(u = 0; u < PHASE_COUNT; u++){
+			fprintf(cfg->stats, "%s\"%s\": %" PRIu64, u ? ", " : "", phase_names[u], stats->phase_us[u]);
+		}
+		fprintf(cfg->stats, "}, \"syscalls\": %u, \"label_syscalls\": %u, \"writes\": %u, \"bytes_sent\": %zu, "
+				"\"raster_lines\": %u, \"white_lines\": %u, \"raster_bytes\": %zu, \"raster_plain\": %zu, "
+				"\"status_frames\": %u, \"status\": %u, \"error1\": %u, \"error2\": %u}\n",
+				cfg->device.syscalls, stats->label_syscalls, stats->writes, stats->bytes_sent,
+				stats->lines_raster, stats->lines_white, cfg->device.raster_sent, cfg->device.raster_plain,
+				stats->status_frames, cfg->device.status.status, cfg->device.status.error1, cfg->device.status.error2);
+		fflush(cfg->stats);
+		funlockfile(cfg->stats);
+	}
+
+	memset(stats, 0, sizeof(STATS));
+}
+
+int main(int argc, char** argv){
+	int count, rv = 0;
+	bool spool;
+	char device_buffer[(DEVICE_BUFFER_LENGTH * sizeof(PROTO_STATUS))];
+	PROTO_STATUS* status = (PROTO_STATUS*)device_buffer;
+
+	CONF cfg = {
+		.device = {
+			.fd = -1,
+			.output = NULL,
+			.fill = 0,
+			.syscalls = 0,
+			.compress = false,
+			.raster_plain = 0,
+			.raster_sent = 0,
+			.cache_valid = false,
+			.prints = 0,
+			.segment_lines = 0,
+			.segment_limit = SEGMENT_LINES
+		},
+		.input = {
+			.fd = -1,
+			.source = NULL,
+			.offset = 0,
+			.length = 0,
+			.failed = false,
+			.eof = false
+		},
+		.chain_print = false,
+		.print_marker = false,
+		.mode = MODE_QUERY,
+		.symbology = SYMBOLOGY_CODE128,
+		.bars = {
+			.width = 0,
+			.height = 0,
+			.offset = 0
+		},
+		.media_width = 0,
+		.socket_path = NULL,
+		.daemon = false,
+		.spool_devices = 0,
+		.stats = NULL,
+		.text = NULL,
+		.renderer = {
+			.fontspec = DEFAULT_FONT,
+			.face = NULL,
+			.height = 0,
+			.cache_path = NULL
+		},
+		.template = {
+			.loaded = false,
+			.elements = 0,
+			.element = NULL,
+			.fields = 0,
+			.field = NULL
+		},
+		.csv = false,
+		.workers = 0,
+		.batch = NULL,
+		.raster = {
+			.version = 0,
+			.big_endian = false
+		},
+		.pipelined = false,
+		.pipeline = NULL,
+		.logger = {
+			.stream = stderr,
+			.verbosity = 1,
+			.cups_logging = false
+		}
+	};
+
+	//parse arguments
+	if(parse_arguments(&cfg, argc - 1, argv + 1) < 0){
+		exit(usage(argv[0]));
+	}
+
+	//hand the job to a running daemon
+	if(cfg.socket_path && !cfg.daemon){
+		rv = submit_job(&cfg);
+		if(cfg.input.fd > 0){
+			close(cfg.input.fd);
+		}
+		return rv;
+	}
+
+	//the spooler opens and initializes all of its printers, retrying those that are offline
+	spool = cfg.daemon && cfg.spool_devices > 1;
+	if(!spool && cfg.device.fd < 0){
+		debug(cfg.logger, LOG_ERROR, "Failed to access the printer\n");
+		exit(usage(argv[0]));
+	}
+	
+	debug(cfg.logger, LOG_DEBUG, "Status structure size %d\n", sizeof(PROTO_STATUS));
+	debug(cfg.logger, LOG_DEBUG, "Init sentence length %d\n", sizeof(PROTO_INIT));
+	debug(cfg.logger, LOG_DEBUG, "Verbosity %d\n", cfg.logger.verbosity);
+
+	if(!spool){
+		count = printer_init(&cfg, sizeof(device_buffer), device_buffer);
+		if(count < 0){
+			return -1;
+		}
+
+		if(cfg.mode == MODE_QUERY || cfg.logger.verbosity > 1){
+			//dump status record
+			print_status(count, status);
+		}
+	}
+	
+	if(spool){
+		rv = run_spooler(&cfg);
+	}
+	else if(cfg.daemon){
+		rv = run_daemon(&cfg);
+	}
+	else if(cfg.mode != MODE_QUERY){
+		rv = print_job(&cfg);
+		debug(cfg.logger, LOG_INFO, "Job used %u device syscalls\n", cfg.device.syscalls);
+		stats_report(&cfg, rv);
+	}
+
+	//clean up
+	batch_free(&cfg);
+	text_renderer_free(&(cfg.renderer));
+	template_free(&(cfg.template));
+	if(cfg.stats && cfg.stats != stdout){
+		fclose(cfg.stats);
+	}
+	if(cfg.device.fd >= 0){
+		close(cfg.device.fd);
+	}
+	if(cfg.input.fd > 0){
+		close(cfg.input.fd);
+	}
+	return rv;
+}
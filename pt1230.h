@@ -1,16 +1,31 @@
 #define DEFAULT_DEVICENODE 	"/dev/usb/lp0"
-#define DEFAULT_ATTEMPTS	5
-#define DEFAULT_TIMEOUT		200
+#define DEFAULT_FONT		"FreeSerif"
+#define DEFAULT_TIMEOUT		500	//Status response timeout (ms)
+#define DEFAULT_WRITE_TIMEOUT	10000	//Maximum time without write progress (ms)
+#define DEFAULT_PRINT_TIMEOUT	30000	//Maximum time between status reports while printing (ms)
 #define DEVICE_BUFFER_LENGTH	25
 #define DATA_BUFFER_LENGTH	1024
+#define DAEMON_BACKLOG		32
+#define DAEMON_QUEUE_LENGTH	64
+#define DAEMON_HEADER_TIMEOUT	5000	//Maximum time for a client to send its job header (ms)
+#define DAEMON_DATA_TIMEOUT	10000	//Maximum time without job data from a client (ms)
+#define SPOOL_MAX_DEVICES	16	//Maximum number of printers driven by the spooler
+#define SPOOL_RETRY_INTERVAL	5000	//Interval for reinitializing offline printers (ms)
+#define OUTPUT_BUFFER_LENGTH	8192
+#define BARCODE_MAX_MODULES	4096
+#define BARCODE_MODULE_WIDTH	2	//Default raster lines per barcode module
+#define MATRIX_MAX_SIZE		64	//Maximum side length of 2D symbols in modules
+#define TEMPLATE_MAX_LENGTH	65536	//Maximum label length of templates in raster lines
+#define BATCH_QUEUE_LENGTH	16	//Labels rendered ahead of the device in batch mode
+#define CUPS_MAX_LINE_LENGTH	65536	//Maximum CUPS raster row length in bytes
+#define PIPELINE_RING_LENGTH	32	//Records buffered between pipeline stages
+#define SEGMENT_LINES		1000	//Raster lines per chained segment of long labels (about 14cm, two fit the printer buffer)
 
 #define PROTO_INIT 		"\x1B@"			//Clear data buffer
 #define PROTO_STATUS_REQUEST	"\x1BiS"		//Request printer status
 #define PROTO_RASTER 		"\x1BiR\x01"		//Switch to raster mode
 #define PROTO_RASTERLINE_WHITE	"Z"			//All-white raster line (width-independent)
-							//All-black raster line (12mm) FIXME
-#define PROTO_RASTERLINE_BLACK	"G\x0C\x00\0\0\0\0\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF"
-#define PROTO_RASTERLINE	"G\x0C\x00\0\0\0\0"	//Generic raster line header
+#define PROTO_COMPRESSION	"M\x02"			//Enable TIFF (PackBits) compression
 #define PROTO_PRINT		"\x0C"			//Print current buffer
 #define PROTO_PRINT_FEED	"\x1A"			//Print current buffer and feed for cutting
 
@@ -33,21 +48,185 @@ typedef struct __attribute__((__packed__)) /*_PT1230_STATUS*/ {
 typedef enum /*_1230_MODE*/ {
 	MODE_QUERY=0,
 	MODE_BITMAP=1,
-	MODE_LINEMAP=2
+	MODE_LINEMAP=2,
+	MODE_PACKED=3,
+	MODE_TEXT=4,
+	MODE_BARCODE=5,
+	MODE_TEMPLATE=6
 } MODE;
 
+typedef enum /*_SYMBOLOGY*/ {
+	SYMBOLOGY_CODE128=0,
+	SYMBOLOGY_EAN13=1,
+	SYMBOLOGY_CODE39=2,
+	SYMBOLOGY_QR=3,
+	SYMBOLOGY_DATAMATRIX=4
+} SYMBOLOGY;
+
+typedef enum /*_BITMAP_FORMAT*/ {
+	FORMAT_ASCII=0,
+	FORMAT_PBM=1,
+	FORMAT_XBM=2,
+	FORMAT_CUPS=3
+} BITMAP_FORMAT;
+
 typedef struct /*_LOGGER*/ {
 	FILE* stream;
 	unsigned verbosity;
 	bool cups_logging;
 } LOGGER;
 
+typedef struct /*_MEDIA*/ {
+	uint8_t width;
+	unsigned pixels;
+} MEDIA;
+
+typedef enum /*_STATS_PHASE*/ {
+	PHASE_OPEN = 0,
+	PHASE_DRAIN,
+	PHASE_INIT,
+	PHASE_STATUS,
+	PHASE_TRANSFER,
+	PHASE_PRINT,
+	PHASE_COUNT
+} STATS_PHASE;
+
+typedef struct /*_STATS*/ {
+	uint64_t phase_us[PHASE_COUNT];
+	unsigned writes;
+	size_t bytes_sent;
+	unsigned lines_raster;
+	unsigned lines_white;
+	unsigned status_frames;
+	//most device syscalls used by a single label of the job
+	unsigned label_syscalls;
+} STATS;
+
+//record ring between pipeline stages, see pipeline.c
+typedef struct RING RING;
+typedef struct PIPELINE PIPELINE;
+
+typedef struct /*_DEVICE*/ {
+	int fd;
+	RING* output;
+	size_t fill;
+	uint8_t buffer[OUTPUT_BUFFER_LENGTH];
+	unsigned syscalls;
+	bool compress;
+	size_t raster_plain;
+	size_t raster_sent;
+	unsigned pixels;
+	unsigned pixel_offset;
+	size_t data_offset;
+	size_t data_length;
+	size_t header_length;
+	uint8_t header[16];
+	size_t black_length[2];
+	uint8_t black[2][32];
+	bool cache_valid;
+	uint64_t cache_line;
+	size_t cache_length;
+	uint8_t cache_encoded[32];
+	PROTO_STATUS status;
+	unsigned started;
+	unsigned completed;
+	//print commands sent in the current job, raster lines sent since the last one
+	unsigned prints;
+	size_t segment_lines;
+	size_t segment_limit;
+	STATS stats;
+} DEVICE;
+
+//linemap bar geometry, a height of 0 selects the full printable width, a width of 0 the mode default
+typedef struct /*_BARS*/ {
+	unsigned width;
+	unsigned height;
+	unsigned offset;
+} BARS;
+
+typedef enum /*_ELEMENT_TYPE*/ {
+	ELEMENT_TEXT=0,
+	ELEMENT_BARCODE=1,
+	ELEMENT_BITMAP=2,
+	ELEMENT_BOX=3,
+	ELEMENT_FRAME=4
+} ELEMENT_TYPE;
+
+//template element, positions are raster lines along and pixels across the tape
+typedef struct /*_TEMPLATE_ELEMENT*/ {
+	ELEMENT_TYPE type;
+	unsigned x;
+	unsigned y;
+	unsigned length;
+	unsigned height;
+	SYMBOLOGY symbology;
+	char* data;
+	bool variable;
+} TEMPLATE_ELEMENT;
+
+//packed framebuffer, pixel n of raster line x is bit n of lines[x]
+typedef struct /*_FRAMEBUFFER*/ {
+	uint64_t* lines;
+	size_t length;
+	size_t allocated;
+} FRAMEBUFFER;
+
+typedef struct /*_TEMPLATE*/ {
+	char path[256];
+	bool loaded;
+	time_t mtime;
+	size_t length;
+	size_t elements;
+	TEMPLATE_ELEMENT* element;
+	bool variable;
+	unsigned pixels;
+	FRAMEBUFFER layer;
+	size_t fields;
+	char** field;
+} TEMPLATE;
+
+//CUPS raster stream state, the version is 0 until the sync word was read
+typedef struct /*_CUPS_RASTER*/ {
+	unsigned version;
+	bool big_endian;
+} CUPS_RASTER;
+
+//CSV batch state, see batch.c
+typedef struct BATCH BATCH;
+
+typedef struct /*_INPUT*/ {
+	int fd;
+	RING* source;
+	size_t offset;
+	size_t length;
+	bool failed;
+	bool eof;
+	char buffer[DATA_BUFFER_LENGTH];
+} INPUT;
+
 typedef struct /*_CONFIG*/ {
-	int device_fd;
-	int input_fd;
+	DEVICE device;
+	INPUT input;
 	bool chain_print;
 	bool print_marker;
 	MODE mode;
+	SYMBOLOGY symbology;
+	BARS bars;
+	unsigned media_width;
+	char* socket_path;
+	bool daemon;
+	char* spool_device[SPOOL_MAX_DEVICES];
+	unsigned spool_devices;
+	FILE* stats;
+	char* text;
+	TEXT_RENDERER renderer;
+	TEMPLATE template;
+	bool csv;
+	unsigned workers;
+	BATCH* batch;
+	CUPS_RASTER raster;
+	bool pipelined;
+	PIPELINE* pipeline;
 	LOGGER logger;
 } CONF;
 
@@ -57,3 +236,60 @@ typedef struct /*_CONFIG*/ {
 #define LOG_DEBUG 2
 
 void debug(LOGGER logger, unsigned severity, char* fmt, ...);
+int send_command(LOGGER logger, DEVICE* device, size_t length, char* buffer);
+int fetch_status(LOGGER logger, DEVICE* device, unsigned timeout, size_t buffer_length, char* buffer);
+int device_write(LOGGER logger, DEVICE* device, size_t length, uint8_t* data);
+int input_getc(LOGGER logger, INPUT* input);
+ssize_t input_peek(LOGGER logger, INPUT* input, size_t length);
+size_t input_read(LOGGER logger, INPUT* input, size_t length, uint8_t* data);
+char* input_text(CONF* cfg);
+int send_rasterline(LOGGER logger, DEVICE* device, uint8_t* line, unsigned width);
+int wait_printer(LOGGER logger, DEVICE* device, unsigned prints, bool started, unsigned timeout);
+int print_segment(LOGGER logger, DEVICE* device, bool feed);
+int printer_init(CONF* cfg, size_t buffer_length, char* buffer);
+int print_job(CONF* cfg);
+uint64_t monotonic_us();
+void stats_report(CONF* cfg, int result);
+
+//daemon.c
+int run_daemon(CONF* cfg);
+int submit_job(CONF* cfg);
+int daemon_socket(CONF* cfg);
+int daemon_job_header(CONF* cfg, int client, size_t length, char* header);
+int daemon_job_run(CONF* cfg, int client, char* header);
+
+//spooler.c
+int run_spooler(CONF* cfg);
+
+//barcode.c
+int barcode_symbology(char* name);
+char* barcode_symbology_name(SYMBOLOGY symbology);
+ssize_t barcode_encode(LOGGER logger, SYMBOLOGY symbology, char* data, size_t max_modules, uint8_t* buffer);
+
+//matrixcode.c
+bool matrix_symbology(SYMBOLOGY symbology);
+unsigned matrix_quiet_zone(SYMBOLOGY symbology);
+ssize_t matrix_encode(LOGGER logger, SYMBOLOGY symbology, char* data, uint8_t* buffer);
+uint64_t matrix_column(uint8_t* modules, unsigned size, unsigned column, unsigned module_size);
+
+//template.c
+int template_load(CONF* cfg);
+int template_prepare(CONF* cfg);
+int template_field(CONF* cfg, char* assignment);
+void template_clear_fields(TEMPLATE* template);
+uint64_t* template_render(CONF* cfg, size_t* length);
+void template_free(TEMPLATE* template);
+
+//cupsraster.c
+int process_cups(CONF* cfg);
+
+//pipeline.c
+int pipeline_start(CONF* cfg);
+void pipeline_stop(CONF* cfg);
+int ring_write(RING* ring, size_t length, uint8_t* data);
+int ring_drain(RING* ring);
+ssize_t ring_read(RING* ring, size_t length, uint8_t* data);
+
+//batch.c
+int batch_next(CONF* cfg, TEMPLATE* template, uint64_t** lines, size_t* length);
+void batch_free(CONF* cfg);
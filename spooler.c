@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "textrender.h"
+#include "pt1230.h"
+
+/*
+ * Multi-printer spooler
+ * The main thread accepts jobs and reads their headers, then dispatches them to the
+ * least loaded online printer with compatible media. Every printer is driven by its
+ * own I/O thread with a copy of the configuration. Idle printers steal compatible
+ * jobs from the longest queue of the other printers, so jobs are not held up behind
+ * a long label while another printer is free. Printers reporting errors are taken
+ * offline and reinitialized periodically, their queued jobs are left to be stolen.
+ */
+
+typedef struct /*_SPOOL_JOB*/ {
+	int client;
+	unsigned media;
+	char header[DATA_BUFFER_LENGTH];
+	INPUT input;
+} SPOOL_JOB;
+
+typedef struct SPOOLER SPOOLER;
+
+typedef struct /*_SPOOL_DEVICE*/ {
+	SPOOLER* spooler;
+	char* node;
+	CONF cfg;
+	pthread_t thread;
+	bool started;
+	bool ready;
+	bool online;
+	bool busy;
+	unsigned media;
+	struct timespec retry;
+	size_t head;
+	size_t queued;
+	SPOOL_JOB* queue[DAEMON_QUEUE_LENGTH];
+} SPOOL_DEVICE;
+
+struct SPOOLER {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t space;
+	bool shutdown;
+	unsigned devices;
+	SPOOL_DEVICE device[SPOOL_MAX_DEVICES];
+};
+
+static unsigned spool_media(SPOOL_DEVICE* device){
+	return device->cfg.media_width ? device->cfg.media_width : device->cfg.device.status.media_width;
+}
+
+//the media width is copied under the spooler lock, as the printer thread updates its status while printing
+static bool spool_compatible(SPOOL_DEVICE* device, SPOOL_JOB* job){
+	return device->online && (!job->media || job->media == device->media);
+}
+
+//(re)open and initialize the printer, returns whether it is ready to take jobs
+static bool spool_init(SPOOL_DEVICE* device){
+	char device_buffer[(DEVICE_BUFFER_LENGTH * sizeof(PROTO_STATUS))];
+	CONF* cfg = &(device->cfg);
+	uint64_t start;
+
+	if(cfg->device.fd < 0){
+		start = monotonic_us();
+		cfg->device.fd = open(device->node, O_RDWR | O_NONBLOCK);
+		cfg->device.stats.phase_us[PHASE_OPEN] += monotonic_us() - start;
+		if(cfg->device.fd < 0){
+			debug(cfg->logger, LOG_WARNING, "Failed to open printer %s: %s\n", device->node, strerror(errno));
+			return false;
+		}
+	}
+
+	cfg->device.fill = 0;
+	if(printer_init(cfg, sizeof(device_buffer), device_buffer) < 0){
+		debug(cfg->logger, LOG_WARNING, "Failed to initialize printer %s\n", device->node);
+		close(cfg->device.fd);
+		cfg->device.fd = -1;
+		return false;
+	}
+
+	if(cfg->device.status.error1 || cfg->device.status.error2){
+		debug(cfg->logger, LOG_WARNING, "Printer %s reports error %02X %02X, taking it offline\n", device->node,
+				cfg->device.status.error1, cfg->device.status.error2);
+		return false;
+	}
+
+	debug(cfg->logger, LOG_INFO, "Printer %s online with %umm media\n", device->node, spool_media(device));
+	return true;
+}
+
+static SPOOL_JOB* spool_dequeue(SPOOL_DEVICE* device, size_t position){
+	SPOOL_JOB* job = device->queue[(device->head + position) % DAEMON_QUEUE_LENGTH];
+	size_t u;
+
+	//close the gap towards the head of the queue
+	for(u = position; u > 0; u--){
+		device->queue[(device->head + u) % DAEMON_QUEUE_LENGTH] = device->queue[(device->head + u - 1) % DAEMON_QUEUE_LENGTH];
+	}
+	device->head = (device->head + 1) % DAEMON_QUEUE_LENGTH;
+	device->queued--;
+	return job;
+}
+
+//take the next job of the device, or steal the oldest compatible job from the longest queue
+static SPOOL_JOB* spool_take(SPOOLER* spooler, SPOOL_DEVICE* device){
+	SPOOL_DEVICE* victim = NULL;
+	size_t u, position;
+
+	if(device->queued){
+		return spool_dequeue(device, 0);
+	}
+
+	for(u = 0; u < spooler->devices; u++){
+		if(spooler->device + u == device || !spooler->device[u].queued){
+			continue;
+		}
+		if(!victim || spooler->device[u].queued > victim->queued){
+			victim = spooler->device + u;
+		}
+	}
+
+	for(position = 0; victim && position < victim->queued; position++){
+		if(spool_compatible(device, victim->queue[(victim->head + position) % DAEMON_QUEUE_LENGTH])){
+			debug(device->cfg.logger, LOG_DEBUG, "Printer %s took job from %s\n", device->node, victim->node);
+			return spool_dequeue(victim, position);
+		}
+	}
+	return NULL;
+}
+
+static void* spool_device_thread(void* context){
+	SPOOL_DEVICE* device = (SPOOL_DEVICE*)context;
+	SPOOLER* spooler = device->spooler;
+	SPOOL_JOB* job;
+	bool online = spool_init(device);
+	int rv;
+
+	pthread_mutex_lock(&(spooler->lock));
+	device->ready = true;
+	device->online = online;
+	device->media = spool_media(device);
+	clock_gettime(CLOCK_REALTIME, &(device->retry));
+	device->retry.tv_sec += SPOOL_RETRY_INTERVAL / 1000;
+	pthread_cond_broadcast(&(spooler->space));
+
+	while(!spooler->shutdown){
+		//offline printers are reinitialized periodically
+		if(!device->online){
+			if(pthread_cond_timedwait(&(spooler->work), &(spooler->lock), &(device->retry)) != ETIMEDOUT){
+				continue;
+			}
+			pthread_mutex_unlock(&(spooler->lock));
+			online = spool_init(device);
+			pthread_mutex_lock(&(spooler->lock));
+			device->online = online;
+			device->media = spool_media(device);
+			clock_gettime(CLOCK_REALTIME, &(device->retry));
+			device->retry.tv_sec += SPOOL_RETRY_INTERVAL / 1000;
+			pthread_cond_broadcast(&(spooler->space));
+			continue;
+		}
+
+		job = spool_take(spooler, device);
+		if(!job){
+			pthread_cond_wait(&(spooler->work), &(spooler->lock));
+			continue;
+		}
+		device->busy = true;
+		pthread_cond_broadcast(&(spooler->space));
+		pthread_mutex_unlock(&(spooler->lock));
+
+		device->cfg.input = job->input;
+		rv = daemon_job_run(&(device->cfg), job->client, job->header);
+		close(job->client);
+		free(job);
+
+		//bring the printer back into a known state
+		online = true;
+		if(rv < 0){
+			debug(device->cfg.logger, LOG_INFO, "Reinitializing printer %s\n", device->node);
+			online = spool_init(device);
+		}
+
+		pthread_mutex_lock(&(spooler->lock));
+		device->busy = false;
+		device->online = online;
+		device->media = spool_media(device);
+		if(!online){
+			clock_gettime(CLOCK_REALTIME, &(device->retry));
+			device->retry.tv_sec += SPOOL_RETRY_INTERVAL / 1000;
+			//queued jobs are left to compatible printers
+			pthread_cond_broadcast(&(spooler->work));
+		}
+		pthread_cond_broadcast(&(spooler->space));
+	}
+	pthread_mutex_unlock(&(spooler->lock));
+	return NULL;
+}
+
+//queue a job on the least loaded compatible printer, waiting for queue space if required
+static int spool_dispatch(CONF* cfg, SPOOLER* spooler, SPOOL_JOB* job){
+	SPOOL_DEVICE* target;
+	bool compatible;
+	unsigned u;
+
+	pthread_mutex_lock(&(spooler->lock));
+	while(true){
+		target = NULL;
+		compatible = false;
+		for(u = 0; u < spooler->devices; u++){
+			//printers still initializing may turn out compatible
+			compatible |= spool_compatible(spooler->device + u, job) || !spooler->device[u].ready;
+			if(!spool_compatible(spooler->device + u, job) || spooler->device[u].queued >= DAEMON_QUEUE_LENGTH){
+				continue;
+			}
+			if(!target || spooler->device[u].queued + spooler->device[u].busy < target->queued + target->busy){
+				target = spooler->device + u;
+			}
+		}
+
+		if(target || !compatible){
+			break;
+		}
+		pthread_cond_wait(&(spooler->space), &(spooler->lock));
+	}
+
+	if(target){
+		target->queue[(target->head + target->queued) % DAEMON_QUEUE_LENGTH] = job;
+		target->queued++;
+		debug(cfg->logger, LOG_DEBUG, "Queued job for printer %s, %zu jobs queued there\n", target->node, target->queued);
+		pthread_cond_broadcast(&(spooler->work));
+	}
+	pthread_mutex_unlock(&(spooler->lock));
+	return target ? 0 : -1;
+}
+
+static SPOOL_JOB* spool_accept(CONF* cfg, int client){
+	SPOOL_JOB* job = calloc(1, sizeof(SPOOL_JOB));
+	char header[DATA_BUFFER_LENGTH];
+	char* save = NULL;
+	char* token;
+
+	if(!job){
+		debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+		dprintf(client, "ERROR out of memory\n");
+		return NULL;
+	}
+
+	if(daemon_job_header(cfg, client, sizeof(job->header), job->header) < 0){
+		debug(cfg->logger, LOG_WARNING, "Failed to read job header\n");
+		dprintf(client, "ERROR invalid job header\n");
+		free(job);
+		return NULL;
+	}
+	job->client = client;
+	job->input = cfg->input;
+
+	//the required media width selects the printers able to take the job
+	strncpy(header, job->header, sizeof(header));
+	for(token = strtok_r(header, " \t\r", &save); token; token = strtok_r(NULL, " \t\r", &save)){
+		if(!strncmp(token, "media=", 6)){
+			job->media = strtoul(token + 6, NULL, 10);
+		}
+	}
+	return job;
+}
+
+int run_spooler(CONF* cfg){
+	SPOOLER* spooler = calloc(1, sizeof(SPOOLER));
+	struct pollfd pfd = {
+		.events = POLLIN
+	};
+	SPOOL_JOB* job;
+	SPOOL_DEVICE* device;
+	int client;
+	unsigned u;
+
+	if(!spooler){
+		debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+		return -1;
+	}
+	pthread_mutex_init(&(spooler->lock), NULL);
+	pthread_cond_init(&(spooler->work), NULL);
+	pthread_cond_init(&(spooler->space), NULL);
+
+	pfd.fd = daemon_socket(cfg);
+	if(pfd.fd < 0){
+		free(spooler);
+		return -1;
+	}
+
+	//fontconfig is process-global, the font is resolved once and opened by every printer thread
+	if(!text_renderer_font(&(cfg->renderer))){
+		debug(cfg->logger, LOG_WARNING, "Failed to open font %s, text jobs will fail\n", cfg->renderer.fontspec);
+	}
+
+	for(u = 0; u < cfg->spool_devices; u++){
+		device = spooler->device + u;
+		device->spooler = spooler;
+		device->node = cfg->spool_device[u];
+		device->cfg = *cfg;
+		device->cfg.device.fd = -1;
+		device->cfg.renderer = text_renderer_share(&(cfg->renderer));
+		if(cfg->renderer.resolved && !text_renderer_font(&(device->cfg.renderer))){
+			debug(cfg->logger, LOG_WARNING, "Failed to open font %s for printer %s\n", cfg->renderer.fontspec, device->node);
+		}
+
+		if(pthread_create(&(device->thread), NULL, spool_device_thread, device)){
+			debug(cfg->logger, LOG_ERROR, "Failed to start thread for printer %s\n", device->node);
+			break;
+		}
+		device->started = true;
+		pthread_mutex_lock(&(spooler->lock));
+		spooler->devices++;
+		pthread_mutex_unlock(&(spooler->lock));
+	}
+	debug(cfg->logger, LOG_INFO, "Spooling to %u printers\n", spooler->devices);
+
+	while(spooler->devices == cfg->spool_devices){
+		if(poll(&pfd, 1, -1) < 0 && errno != EINTR){
+			debug(cfg->logger, LOG_ERROR, "daemon/poll: %s\n", strerror(errno));
+			break;
+		}
+
+		client = accept(pfd.fd, NULL, NULL);
+		if(client < 0){
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+				debug(cfg->logger, LOG_WARNING, "daemon/accept: %s\n", strerror(errno));
+			}
+			continue;
+		}
+
+		job = spool_accept(cfg, client);
+		if(!job){
+			close(client);
+			continue;
+		}
+
+		if(spool_dispatch(cfg, spooler, job) < 0){
+			debug(cfg->logger, LOG_WARNING, "No online printer is compatible with job: %s\n", job->header);
+			dprintf(client, "ERROR no compatible printer\n");
+			close(client);
+			free(job);
+		}
+	}
+
+	//stop the printer threads and fail all queued jobs
+	pthread_mutex_lock(&(spooler->lock));
+	spooler->shutdown = true;
+	pthread_cond_broadcast(&(spooler->work));
+	pthread_mutex_unlock(&(spooler->lock));
+
+	for(u = 0; u < cfg->spool_devices; u++){
+		device = spooler->device + u;
+		if(device->started){
+			pthread_join(device->thread, NULL);
+		}
+		for(; device->queued; device->queued--){
+			job = device->queue[device->head];
+			dprintf(job->client, "ERROR spooler stopped\n");
+			close(job->client);
+			free(job);
+			device->head = (device->head + 1) % DAEMON_QUEUE_LENGTH;
+		}
+		text_renderer_free(&(device->cfg.renderer));
+		template_free(&(device->cfg.template));
+		if(device->cfg.device.fd >= 0){
+			close(device->cfg.device.fd);
+		}
+	}
+
+	close(pfd.fd);
+	unlink(cfg->socket_path);
+	pthread_mutex_destroy(&(spooler->lock));
+	pthread_cond_destroy(&(spooler->work));
+	pthread_cond_destroy(&(spooler->space));
+	free(spooler);
+	return -1;
+}
@@ -0,0 +1,556 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "textrender.h"
+#include "pt1230.h"
+
+/*
+ * Label templates
+ * A template places text, barcode, bitmap and box elements on the label. Elements
+ * without {field} references form the static layer, which is rendered once per media
+ * width into a packed framebuffer. Every label starts from a copy of that layer and
+ * only renders the elements referencing fields.
+ *
+ * Template file format, one element per line, positions are raster lines along the
+ * tape (x) and pixels from the tape edge (y):
+ *	length <lines>
+ *	text <x> <y> <height> <text>
+ *	barcode <symbology> <x> <y> <height> <data>
+ *	bitmap <x> <y> <file>
+ *	box <x> <y> <length> <height>
+ *	frame <x> <y> <length> <height>
+ */
+
+static char* element_names[] = {
+	[ELEMENT_TEXT] = "text",
+	[ELEMENT_BARCODE] = "barcode",
+	[ELEMENT_BITMAP] = "bitmap",
+	[ELEMENT_BOX] = "box",
+	[ELEMENT_FRAME] = "frame"
+};
+
+//mask of height pixels starting at offset, clipped to the raster line
+static uint64_t pixel_span(unsigned offset, unsigned height){
+	uint64_t span;
+
+	if(offset >= 64 || !height){
+		return 0;
+	}
+	span = (height >= 64) ? ~0ULL : ((1ULL << height) - 1);
+	return span << offset;
+}
+
+static int framebuffer_extend(LOGGER logger, FRAMEBUFFER* fb, size_t length){
+	uint64_t* lines;
+	size_t allocated;
+
+	if(length > TEMPLATE_MAX_LENGTH){
+		debug(logger, LOG_ERROR, "Label exceeds maximum length of %u raster lines\n", TEMPLATE_MAX_LENGTH);
+		return -1;
+	}
+
+	if(length > fb->allocated){
+		allocated = (fb->allocated * 2 > length) ? fb->allocated * 2 : length;
+		lines = realloc(fb->lines, allocated * sizeof(uint64_t));
+		if(!lines){
+			debug(logger, LOG_ERROR, "Failed to allocate memory\n");
+			return -1;
+		}
+		fb->lines = lines;
+		fb->allocated = allocated;
+	}
+
+	if(length > fb->length){
+		memset(fb->lines + fb->length, 0, (length - fb->length) * sizeof(uint64_t));
+		fb->length = length;
+	}
+	return 0;
+}
+
+static int render_text(CONF* cfg, TEMPLATE_ELEMENT* element, char* data, FRAMEBUFFER* fb){
+	char** lines = NULL;
+	uint64_t* rendered;
+	size_t raster_lines, u;
+
+	if(text_split(data, &lines) < 0){
+		return -1;
+	}
+	rendered = text_render(&(cfg->renderer), lines, element->height, &raster_lines);
+	text_free_lines(lines);
+	if(!rendered){
+		debug(cfg->logger, LOG_ERROR, "Failed to render text\n");
+		return -1;
+	}
+
+	if(framebuffer_extend(cfg->logger, fb, element->x + raster_lines) < 0){
+		free(rendered);
+		return -1;
+	}
+	for(u = 0; u < raster_lines && element->y < 64; u++){
+		fb->lines[element->x + u] |= rendered[u] << element->y;
+	}
+	free(rendered);
+	return 0;
+}
+
+static int render_barcode(CONF* cfg, TEMPLATE_ELEMENT* element, char* data, FRAMEBUFFER* fb){
+	uint8_t modules[(BARCODE_MAX_MODULES > MATRIX_MAX_SIZE * MATRIX_MAX_SIZE) ? BARCODE_MAX_MODULES : MATRIX_MAX_SIZE * MATRIX_MAX_SIZE];
+	uint64_t bar = pixel_span(element->y, element->height), column;
+	unsigned module_size, quiet, u, v;
+	ssize_t count;
+
+	if(!matrix_symbology(element->symbology)){
+		count = barcode_encode(cfg->logger, element->symbology, data, BARCODE_MAX_MODULES, modules);
+		if(count < 0 || framebuffer_extend(cfg->logger, fb, element->x + count * BARCODE_MODULE_WIDTH) < 0){
+			return -1;
+		}
+		for(u = 0; u < count; u++){
+			for(v = 0; modules[u] && v < BARCODE_MODULE_WIDTH; v++){
+				fb->lines[element->x + u * BARCODE_MODULE_WIDTH + v] |= bar;
+			}
+		}
+		return 0;
+	}
+
+	//2D symbols use the largest module size fitting the element height
+	count = matrix_encode(cfg->logger, element->symbology, data, modules);
+	if(count < 0){
+		return -1;
+	}
+	module_size = element->height / count;
+	if(!module_size){
+		debug(cfg->logger, LOG_ERROR, "Symbol of %zd modules exceeds element height of %u pixels\n", count, element->height);
+		return -1;
+	}
+
+	quiet = matrix_quiet_zone(element->symbology) * module_size;
+	if(framebuffer_extend(cfg->logger, fb, element->x + 2 * quiet + count * module_size) < 0){
+		return -1;
+	}
+	for(u = 0; u < count; u++){
+		column = (element->y < 64) ? matrix_column(modules, count, u, module_size) << element->y : 0;
+		for(v = 0; v < module_size; v++){
+			fb->lines[element->x + quiet + u * module_size + v] |= column;
+		}
+	}
+	return 0;
+}
+
+//bitmaps use the ASCII bitmap format, character n of each line maps to pixel y + n
+static int render_bitmap(CONF* cfg, TEMPLATE_ELEMENT* element, char* path, FRAMEBUFFER* fb){
+	char* line = NULL;
+	size_t allocated = 0, x = element->x, u;
+	ssize_t length;
+	FILE* file = fopen(path, "r");
+	int rv = 0;
+
+	if(!file){
+		debug(cfg->logger, LOG_ERROR, "Failed to open template bitmap %s\n", path);
+		return -1;
+	}
+
+	while((length = getline(&line, &allocated, file)) >= 0){
+		if(framebuffer_extend(cfg->logger, fb, x + 1) < 0){
+			rv = -1;
+			break;
+		}
+		for(u = 0; u < length && element->y + u < 64; u++){
+			if(line[u] == '1'){
+				fb->lines[x] |= 1ULL << (element->y + u);
+			}
+		}
+		x++;
+	}
+
+	free(line);
+	fclose(file);
+	return rv;
+}
+
+static int render_box(CONF* cfg, TEMPLATE_ELEMENT* element, FRAMEBUFFER* fb){
+	uint64_t span = pixel_span(element->y, element->height);
+	uint64_t edges = pixel_span(element->y, 1) | pixel_span(element->y + element->height - 1, 1);
+	unsigned u;
+
+	if(framebuffer_extend(cfg->logger, fb, element->x + element->length) < 0){
+		return -1;
+	}
+	for(u = 0; u < element->length; u++){
+		if(element->type == ELEMENT_BOX || !u || u == element->length - 1){
+			fb->lines[element->x + u] |= span;
+		}
+		else{
+			fb->lines[element->x + u] |= edges;
+		}
+	}
+	return 0;
+}
+
+//substitute field references with the values of the current label
+static char* template_expand(CONF* cfg, char* data){
+	TEMPLATE* template = &(cfg->template);
+	size_t length = 0, name_length, u;
+	char* expanded = NULL;
+	char* value;
+	char* end;
+
+	for(; *data; data++){
+		value = NULL;
+		if(*data == '{' && (end = strchr(data, '}'))){
+			name_length = end - data - 1;
+			//the most recent assignment is stored first
+			for(u = 0; u < template->fields && !value; u++){
+				if(!strncmp(template->field[u], data + 1, name_length) && template->field[u][name_length] == '='){
+					value = template->field[u] + name_length + 1;
+				}
+			}
+			if(!value){
+				debug(cfg->logger, LOG_ERROR, "No value for template field %.*s\n", (int)name_length, data + 1);
+				free(expanded);
+				return NULL;
+			}
+			data = end;
+		}
+
+		expanded = realloc(expanded, length + (value ? strlen(value) : 1) + 1);
+		if(!expanded){
+			debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+			return NULL;
+		}
+		if(value){
+			memcpy(expanded + length, value, strlen(value));
+			length += strlen(value);
+		}
+		else{
+			expanded[length++] = *data;
+		}
+	}
+
+	if(!expanded){
+		expanded = calloc(1, 1);
+	}
+	else{
+		expanded[length] = 0;
+	}
+	return expanded;
+}
+
+static int render_element(CONF* cfg, TEMPLATE_ELEMENT* element, FRAMEBUFFER* fb){
+	char* data = NULL;
+	int rv = -1;
+
+	if(element->data){
+		data = element->variable ? template_expand(cfg, element->data) : element->data;
+		if(!data){
+			return -1;
+		}
+	}
+
+	switch(element->type){
+		case ELEMENT_TEXT:
+			rv = render_text(cfg, element, data, fb);
+			break;
+		case ELEMENT_BARCODE:
+			rv = render_barcode(cfg, element, data, fb);
+			break;
+		case ELEMENT_BITMAP:
+			rv = render_bitmap(cfg, element, data, fb);
+			break;
+		case ELEMENT_BOX:
+		case ELEMENT_FRAME:
+			rv = render_box(cfg, element, fb);
+			break;
+	}
+
+	if(data != element->data){
+		free(data);
+	}
+	return rv;
+}
+
+//relative bitmap paths are resolved against the template location
+static char* template_path(TEMPLATE* template, char* path){
+	char* separator = strrchr(template->path, '/');
+	char* resolved;
+
+	if(path[0] == '/' || !separator){
+		return strdup(path);
+	}
+
+	resolved = malloc(separator - template->path + strlen(path) + 2);
+	if(resolved){
+		sprintf(resolved, "%.*s/%s", (int)(separator - template->path), template->path, path);
+	}
+	return resolved;
+}
+
+static int template_parse(CONF* cfg, TEMPLATE* template, char* line, unsigned line_number){
+	TEMPLATE_ELEMENT element = {
+		.data = NULL
+	};
+	char name[32], symbology[32];
+	unsigned u, length;
+	int data = -1;
+
+	if(sscanf(line, "%31s", name) != 1 || name[0] == '#'){
+		return 0;
+	}
+
+	if(!strcmp(name, "length")){
+		if(sscanf(line, "length %u", &length) != 1 || length > TEMPLATE_MAX_LENGTH){
+			debug(cfg->logger, LOG_ERROR, "Invalid label length in line %u of %s\n", line_number, template->path);
+			return -1;
+		}
+		template->length = length;
+		return 0;
+	}
+
+	for(u = 0; u < sizeof(element_names) / sizeof(element_names[0]); u++){
+		if(!strcmp(name, element_names[u])){
+			element.type = u;
+			break;
+		}
+	}
+	if(u == sizeof(element_names) / sizeof(element_names[0])){
+		debug(cfg->logger, LOG_ERROR, "Unknown template element %s in line %u of %s\n", name, line_number, template->path);
+		return -1;
+	}
+
+	switch(element.type){
+		case ELEMENT_TEXT:
+			sscanf(line, " text %u %u %u %n", &element.x, &element.y, &element.height, &data);
+			break;
+		case ELEMENT_BARCODE:
+			sscanf(line, " barcode %31s %u %u %u %n", symbology, &element.x, &element.y, &element.height, &data);
+			if(data >= 0 && barcode_symbology(symbology) < 0){
+				debug(cfg->logger, LOG_ERROR, "Unknown barcode symbology %s in line %u of %s\n", symbology, line_number, template->path);
+				return -1;
+			}
+			element.symbology = barcode_symbology(symbology);
+			break;
+		case ELEMENT_BITMAP:
+			sscanf(line, " bitmap %u %u %n", &element.x, &element.y, &data);
+			break;
+		case ELEMENT_BOX:
+		case ELEMENT_FRAME:
+			sscanf(line, " %*s %u %u %u %u %n", &element.x, &element.y, &element.length, &element.height, &data);
+			break;
+	}
+
+	//elements with data need more than whitespace after the numeric fields
+	if(data < 0 || ((element.type == ELEMENT_TEXT || element.type == ELEMENT_BARCODE || element.type == ELEMENT_BITMAP) && !line[data])
+			|| element.x >= TEMPLATE_MAX_LENGTH || element.length > TEMPLATE_MAX_LENGTH
+			|| ((element.type == ELEMENT_TEXT || element.type == ELEMENT_BARCODE) && (!element.height || element.height > 64))){
+		debug(cfg->logger, LOG_ERROR, "Invalid %s element in line %u of %s\n", name, line_number, template->path);
+		return -1;
+	}
+
+	if(element.type == ELEMENT_TEXT || element.type == ELEMENT_BARCODE || element.type == ELEMENT_BITMAP){
+		element.data = (element.type == ELEMENT_BITMAP) ? template_path(template, line + data) : strdup(line + data);
+		if(!element.data){
+			debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+			return -1;
+		}
+		element.variable = strchr(element.data, '{') && strchr(strchr(element.data, '{'), '}');
+		template->variable |= element.variable;
+	}
+
+	template->element = realloc(template->element, (template->elements + 1) * sizeof(TEMPLATE_ELEMENT));
+	if(!template->element){
+		debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+		template->elements = 0;
+		free(element.data);
+		return -1;
+	}
+	template->element[template->elements++] = element;
+	return 0;
+}
+
+int template_load(CONF* cfg){
+	TEMPLATE* template = &(cfg->template);
+	char* line = NULL;
+	size_t allocated = 0;
+	unsigned line_number = 0;
+	ssize_t length;
+	struct stat info;
+	FILE* file;
+	int rv = 0;
+
+	//templates edited while loaded are reloaded
+	if(template->loaded){
+		if(stat(template->path, &info) || info.st_mtime == template->mtime){
+			return 0;
+		}
+		debug(cfg->logger, LOG_INFO, "Template %s was modified, reloading\n", template->path);
+		template_free(template);
+	}
+
+	file = fopen(template->path, "r");
+	if(!file){
+		debug(cfg->logger, LOG_ERROR, "Failed to open template %s\n", template->path);
+		return -1;
+	}
+
+	template->mtime = fstat(fileno(file), &info) ? 0 : info.st_mtime;
+	while((length = getline(&line, &allocated, file)) >= 0){
+		line_number++;
+		for(; length > 0 && isspace(line[length - 1]); length--){
+			line[length - 1] = 0;
+		}
+		if(template_parse(cfg, template, line, line_number) < 0){
+			rv = -1;
+			break;
+		}
+	}
+
+	free(line);
+	fclose(file);
+	if(rv < 0){
+		template_free(template);
+		return -1;
+	}
+
+	debug(cfg->logger, LOG_INFO, "Loaded template %s with %zu elements\n", template->path, template->elements);
+	template->loaded = true;
+	template->pixels = 0;
+	return 0;
+}
+
+//store a name=value assignment for the current label
+int template_field(CONF* cfg, char* assignment){
+	TEMPLATE* template = &(cfg->template);
+	char** field;
+
+	if(!strchr(assignment, '=')){
+		debug(cfg->logger, LOG_WARNING, "Ignoring invalid field assignment %s\n", assignment);
+		return 0;
+	}
+
+	field = realloc(template->field, (template->fields + 1) * sizeof(char*));
+	if(!field){
+		debug(cfg->logger, LOG_ERROR, "Failed to allocate memory\n");
+		return -1;
+	}
+	template->field = field;
+	//later assignments take precedence
+	memmove(template->field + 1, template->field, template->fields * sizeof(char*));
+	template->field[0] = strdup(assignment);
+	if(!template->field[0]){
+		return -1;
+	}
+	template->fields++;
+	return 0;
+}
+
+void template_clear_fields(TEMPLATE* template){
+	size_t u;
+
+	for(u = 0; u < template->fields; u++){
+		free(template->field[u]);
+	}
+	free(template->field);
+	template->field = NULL;
+	template->fields = 0;
+}
+
+//load the template and render the static layer for the current media width
+int template_prepare(CONF* cfg){
+	TEMPLATE* template = &(cfg->template);
+	uint64_t mask = pixel_span(0, cfg->device.pixels);
+	size_t u;
+
+	if(template_load(cfg) < 0){
+		return -1;
+	}
+
+	//the static layer depends only on the media width
+	if(template->pixels != cfg->device.pixels){
+		template->layer.length = 0;
+		for(u = 0; u < template->elements; u++){
+			if(!template->element[u].variable && render_element(cfg, template->element + u, &(template->layer)) < 0){
+				return -1;
+			}
+		}
+		if(framebuffer_extend(cfg->logger, &(template->layer), template->length) < 0){
+			return -1;
+		}
+		for(u = 0; u < template->layer.length; u++){
+			template->layer.lines[u] &= mask;
+		}
+		template->pixels = cfg->device.pixels;
+		debug(cfg->logger, LOG_DEBUG, "Rendered static template layer of %zu raster lines\n", template->layer.length);
+	}
+	return 0;
+}
+
+//render the current label from the prepared static layer and the variable elements,
+//only reads the shared template state, so copies of the configuration may render concurrently
+uint64_t* template_render(CONF* cfg, size_t* length){
+	TEMPLATE* template = &(cfg->template);
+	uint64_t mask = pixel_span(0, cfg->device.pixels);
+	FRAMEBUFFER fb = {
+		.lines = NULL,
+		.length = 0,
+		.allocated = 0
+	};
+	size_t u;
+
+	if(!template->loaded || template->pixels != cfg->device.pixels){
+		debug(cfg->logger, LOG_ERROR, "Template not prepared for the current media\n");
+		return NULL;
+	}
+
+	if(framebuffer_extend(cfg->logger, &fb, template->layer.length) < 0){
+		return NULL;
+	}
+	memcpy(fb.lines, template->layer.lines, template->layer.length * sizeof(uint64_t));
+
+	for(u = 0; u < template->elements; u++){
+		if(template->element[u].variable && render_element(cfg, template->element + u, &fb) < 0){
+			free(fb.lines);
+			return NULL;
+		}
+	}
+
+	//variable elements extending a fixed label length are cut off
+	*length = fb.length;
+	if(template->length && fb.length > template->length){
+		debug(cfg->logger, LOG_WARNING, "Template elements exceed the label length of %zu raster lines\n", template->length);
+		*length = template->length;
+	}
+	for(u = 0; u < *length; u++){
+		fb.lines[u] &= mask;
+	}
+	return fb.lines;
+}
+
+void template_free(TEMPLATE* template){
+	size_t u;
+
+	for(u = 0; u < template->elements; u++){
+		free(template->element[u].data);
+	}
+	free(template->element);
+	free(template->layer.lines);
+	template_clear_fields(template);
+
+	template->element = NULL;
+	template->elements = 0;
+	template->length = 0;
+	template->variable = false;
+	template->loaded = false;
+	template->pixels = 0;
+	template->layer.lines = NULL;
+	template->layer.length = 0;
+	template->layer.allocated = 0;
+}
@@ -0,0 +1,752 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_GLYPH_H
+#include <fontconfig/fontconfig.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "textrender.h"
+
+/*
+ * Text rendering shared by textlabel and pt1230
+ * Text lines are rendered from the bottom up into a packed framebuffer
+ * with one 64-bit word per 64 pixels of each raster line.
+ */
+
+#define max(a,b) (( (a) > (b) ) ? (a) : (b))
+
+size_t stored_lines(char** lines){
+	size_t u;
+	if(!lines){
+		return 0;
+	}
+
+	for(u = 0; lines[u]; u++){
+	}
+	return u;
+}
+
+static int line_store(char*** lines, char* line){
+	size_t size = 0;
+
+	//expand array
+	size = stored_lines(*lines);
+	*lines = realloc(*lines, (size + 2) * sizeof(char*));
+	if(!(*lines)){
+		return -1;
+	}
+
+	//allocate
+	*((*lines) + size + 1) = NULL;
+	*((*lines) + size) = calloc(strlen(line) + 1, sizeof(char));
+	if(!*((*lines) + size)){
+		return -1;
+	}
+
+	//store
+	strncpy(*((*lines) + size), line, strlen(line));
+	return 0;
+}
+
+//convert escaped characters and split text into lines, returns the number of lines
+int text_split(char* text, char*** lines){
+	char* current_line = calloc(strlen(text) + 1, sizeof(char));
+	size_t i, c;
+
+	if(!current_line){
+		fprintf(stderr, "Failed to allocate memory\n");
+		return -1;
+	}
+
+	//convert escaped characters
+	c = 0;
+	for(i = 0; text[i]; i++){
+		if(text[i] == '\\' && text[i + 1]){
+			switch(text[i + 1]){
+				case 'n':
+					current_line[c] = '\n';
+					break;
+				default:
+					current_line[c] = text[i + 1];
+			}
+			i++;
+		}
+		else{
+			current_line[c] = text[i];
+		}
+		c++;
+	}
+	current_line[c] = 0;
+
+	//split into lines
+	c = 0;
+	for(i = 0; current_line[i]; i++){
+		if(current_line[i] == '\n'){
+			current_line[i] = 0;
+			if(line_store(lines, current_line + c) < 0){
+				fprintf(stderr, "Failed to store line\n");
+				free(current_line);
+				return -1;
+			}
+			c = i + 1;
+		}
+	}
+	if(line_store(lines, current_line + c) < 0){
+		fprintf(stderr, "Failed to store line\n");
+		free(current_line);
+		return -1;
+	}
+
+	free(current_line);
+	return stored_lines(*lines);
+}
+
+void text_free_lines(char** lines){
+	size_t u;
+
+	if(!lines){
+		return;
+	}
+
+	for(u = 0; lines[u]; u++){
+		free(lines[u]);
+	}
+	free(lines);
+}
+
+static FcPattern* match_font(char* fontspec){
+	FcPattern* font_pattern = NULL;
+	FcPattern* match = NULL;
+	FcResult fc_result = 0;
+
+	font_pattern = FcNameParse((FcChar8*)fontspec);
+
+	if(!font_pattern){
+		return NULL;
+	}
+
+	FcDefaultSubstitute(font_pattern);
+	if(FcConfigSubstitute(NULL, font_pattern, FcMatchFont)){
+		match = FcFontMatch(NULL, font_pattern, &fc_result);
+		FcPatternDestroy(font_pattern);
+		switch(fc_result){
+			case FcResultMatch:
+				return match;
+			case FcResultNoMatch:
+				fprintf(stderr, "No Match: %s\n", FcNameUnparse(font_pattern));
+				break;
+			case FcResultTypeMismatch:
+				fprintf(stderr, "Type Mismatch: %s\n", FcNameUnparse(match));
+				return match;
+			case FcResultNoId:
+				fprintf(stderr, "No ID: %s\n", FcNameUnparse(match));
+				break;
+			case FcResultOutOfMemory:
+				fprintf(stderr, "FontConfig error: out of memory\n");
+				return NULL;
+		}
+	}
+
+	fprintf(stderr, "Failed to match font to config\n");
+	return NULL;
+}
+
+//resolve a fontspec to a font file and face index using fontconfig
+static bool resolve_font(char* fontspec, FONT_LOCATION* location){
+	FcPattern* pattern = match_font(fontspec);
+	char* font_file = NULL;
+	int index = 0;
+
+	if(!pattern){
+		fprintf(stderr, "No pattern provided\n");
+		return false;
+	}
+
+	if(FcPatternGetString(pattern, FC_FILE, 0, (FcChar8**)&font_file) != FcResultMatch
+			|| strlen(font_file) >= sizeof(location->file)){
+		fprintf(stderr, "Failed to find font location\n");
+		FcPatternDestroy(pattern);
+		return false;
+	}
+	//fprintf(stderr, "Font file %s\n", font_file);
+
+	FcPatternGetInteger(pattern, FC_INDEX, 0, &index);
+	strncpy(location->file, font_file, sizeof(location->file) - 1);
+	location->index = index;
+	FcPatternDestroy(pattern);
+	return true;
+}
+
+//modification stamp of the fontconfig configuration and caches, used to invalidate resolved fonts
+static int64_t fontconfig_stamp(){
+	char path[FONT_PATH_LENGTH];
+	char* paths[] = {
+		getenv("FONTCONFIG_FILE") ? getenv("FONTCONFIG_FILE") : "/etc/fonts/fonts.conf",
+		"/etc/fonts/conf.d",
+		"/var/cache/fontconfig",
+		path
+	};
+	struct stat info;
+	int64_t stamp = 0;
+	size_t u;
+
+	if(getenv("XDG_CACHE_HOME")){
+		snprintf(path, sizeof(path), "%s/fontconfig", getenv("XDG_CACHE_HOME"));
+	}
+	else{
+		snprintf(path, sizeof(path), "%s/.cache/fontconfig", getenv("HOME") ? getenv("HOME") : "");
+	}
+
+	for(u = 0; u < sizeof(paths) / sizeof(paths[0]); u++){
+		if(!stat(paths[u], &info)){
+			stamp = max(stamp, ((int64_t)info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec);
+		}
+	}
+	return stamp;
+}
+
+//look up a previously resolved fontspec, entries are stored as stamp, index, fontspec and file separated by tabs
+static bool font_cache_lookup(char* cache_file, char* fontspec, int64_t stamp, FONT_LOCATION* location){
+	char line[FONT_PATH_LENGTH * 2];
+	char* fields[4];
+	struct stat info;
+	bool found = false;
+	size_t u;
+	FILE* file = fopen(cache_file, "r");
+
+	if(!file){
+		return false;
+	}
+
+	while(!found && fgets(line, sizeof(line), file)){
+		line[strcspn(line, "\n")] = 0;
+		fields[0] = strtok(line, "\t");
+		for(u = 1; u < 4; u++){
+			fields[u] = strtok(NULL, "\t");
+		}
+
+		if(fields[3] && strtoll(fields[0], NULL, 10) == stamp && !strcmp(fields[2], fontspec)
+				&& strlen(fields[3]) < sizeof(location->file) && !stat(fields[3], &info)){
+			strncpy(location->file, fields[3], sizeof(location->file) - 1);
+			location->index = strtoul(fields[1], NULL, 10);
+			found = true;
+		}
+	}
+
+	fclose(file);
+	return found;
+}
+
+//replace the entry for a fontspec, dropping entries from outdated configurations
+static void font_cache_store(char* cache_file, char* fontspec, int64_t stamp, FONT_LOCATION* location){
+	char line[FONT_PATH_LENGTH * 2], entry[FONT_PATH_LENGTH * 2];
+	char* temp_path;
+	char* spec;
+	FILE* input, *output;
+
+	//entries are tab separated, fontspecs containing tabs are not cached
+	if(strpbrk(fontspec, "\t\n")){
+		return;
+	}
+
+	temp_path = calloc(strlen(cache_file) + 32, sizeof(char));
+	if(!temp_path){
+		return;
+	}
+
+	snprintf(temp_path, strlen(cache_file) + 32, "%s.%d", cache_file, getpid());
+	output = fopen(temp_path, "w");
+	if(!output){
+		fprintf(stderr, "Failed to write font cache %s\n", temp_path);
+		free(temp_path);
+		return;
+	}
+
+	input = fopen(cache_file, "r");
+	if(input){
+		while(fgets(line, sizeof(line), input)){
+			strncpy(entry, line, sizeof(entry));
+			spec = strtok(entry, "\t");
+			spec = spec ? strtok(NULL, "\t") : NULL;
+			spec = spec ? strtok(NULL, "\t") : NULL;
+			if(spec && strtoll(line, NULL, 10) == stamp && strcmp(spec, fontspec)){
+				fputs(line, output);
+			}
+		}
+		fclose(input);
+	}
+
+	fprintf(output, "%" PRId64 "\t%d\t%s\t%s\n", stamp, location->index, fontspec, location->file);
+	if(fclose(output) || rename(temp_path, cache_file)){
+		fprintf(stderr, "Failed to store font cache %s\n", cache_file);
+		unlink(temp_path);
+	}
+	free(temp_path);
+}
+
+static bool load_font(FT_Library ft, FONT_LOCATION* location, FT_Face* face, GLYPH_CACHE_HEADER* font_info){
+	struct stat info;
+
+	//cached glyphs are only valid for the exact font file
+	strncpy(font_info->font_file, location->file, sizeof(font_info->font_file) - 1);
+	if(!stat(location->file, &info)){
+		font_info->font_mtime = info.st_mtime;
+		font_info->font_size = info.st_size;
+	}
+
+	switch(FT_New_Face(ft, location->file, location->index, face)){
+		case FT_Err_Unknown_File_Format:
+			fprintf(stderr, "Unknown font file format\n");
+			return false;
+		case 0:
+			break;
+		default:
+			fprintf(stderr, "Unknown freetype error\n");
+			return false;
+	}
+
+	return true;
+}
+
+static uint64_t fnv1a(char* data){
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(; *data; data++){
+		hash = (hash ^ (uint8_t)*data) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static char* glyph_cache_path(char* directory, char* fontspec, unsigned height){
+	size_t length = strlen(directory) + 64;
+	char* path = calloc(length, sizeof(char));
+	if(path){
+		snprintf(path, length, "%s/%016" PRIx64 "-%u.glyphs", directory, fnv1a(fontspec), height);
+	}
+	return path;
+}
+
+//map a cache file from a previous run, mismatching or damaged files are ignored
+static void glyph_cache_load(GLYPH_CACHE* cache, char* path){
+	GLYPH_CACHE_HEADER* header;
+	GLYPH* table;
+	struct stat info;
+	size_t u;
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0){
+		return;
+	}
+
+	if(fstat(fd, &info) || info.st_size < sizeof(GLYPH_CACHE_HEADER)){
+		close(fd);
+		return;
+	}
+
+	cache->map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(cache->map == MAP_FAILED){
+		cache->map = NULL;
+		return;
+	}
+	cache->map_length = info.st_size;
+
+	header = cache->map;
+	table = (GLYPH*)(header + 1);
+	if(memcmp(header->magic, GLYPH_CACHE_MAGIC, sizeof(header->magic))
+			|| header->height != cache->header.height
+			|| header->descender != cache->header.descender
+			|| header->font_mtime != cache->header.font_mtime
+			|| header->font_size != cache->header.font_size
+			|| strncmp(header->font_file, cache->header.font_file, sizeof(header->font_file))
+			|| header->count > 256
+			|| sizeof(GLYPH_CACHE_HEADER) + header->count * sizeof(GLYPH) + header->data_length > info.st_size){
+		//stale cache, rebuilt on exit
+		cache->dirty = true;
+		return;
+	}
+
+	for(u = 0; u < header->count; u++){
+		if(table[u].codepoint > 255
+				|| table[u].offset + table[u].rows * table[u].pitch > header->data_length){
+			cache->dirty = true;
+			return;
+		}
+		cache->glyphs[table[u].codepoint] = table[u];
+		cache->valid[table[u].codepoint] = true;
+	}
+
+	//bitmap data is used in place until new glyphs need to be added
+	cache->data = (uint8_t*)(table + header->count);
+	cache->header.count = header->count;
+	cache->header.data_length = header->data_length;
+}
+
+//write the cache to a temporary file first, so concurrent runs never read partial data
+static void glyph_cache_store(GLYPH_CACHE* cache, char* path){
+	char* temp_path = calloc(strlen(path) + 32, sizeof(char));
+	FILE* file;
+	size_t u;
+
+	if(!temp_path){
+		return;
+	}
+
+	snprintf(temp_path, strlen(path) + 32, "%s.%d", path, getpid());
+	file = fopen(temp_path, "w");
+	if(!file){
+		fprintf(stderr, "Failed to write glyph cache %s\n", temp_path);
+		free(temp_path);
+		return;
+	}
+
+	memcpy(cache->header.magic, GLYPH_CACHE_MAGIC, sizeof(cache->header.magic));
+	fwrite(&(cache->header), sizeof(GLYPH_CACHE_HEADER), 1, file);
+	for(u = 0; u < 256; u++){
+		if(cache->valid[u]){
+			fwrite(cache->glyphs + u, sizeof(GLYPH), 1, file);
+		}
+	}
+	fwrite(cache->data, 1, cache->header.data_length, file);
+
+	if(fclose(file) || rename(temp_path, path)){
+		fprintf(stderr, "Failed to store glyph cache %s\n", path);
+		unlink(temp_path);
+	}
+	free(temp_path);
+}
+
+static void glyph_cache_free(GLYPH_CACHE* cache){
+	if(cache->map){
+		munmap(cache->map, cache->map_length);
+	}
+	if(cache->data_size){
+		free(cache->data);
+	}
+}
+
+//render a glyph into the cache, returns NULL on failure
+static GLYPH* glyph_render(GLYPH_CACHE* cache, FT_Face font_face, uint8_t codepoint){
+	FT_Glyph glyph;
+	FT_BitmapGlyph bitmap;
+	GLYPH* entry = cache->glyphs + codepoint;
+	size_t length, size;
+	uint8_t* data;
+
+	if(FT_Load_Glyph(font_face, FT_Get_Char_Index(font_face, codepoint), FT_LOAD_DEFAULT)){
+		fprintf(stderr, "Font has no glyph for %c, aborting\n", codepoint);
+		return NULL;
+	}
+
+	if(FT_Get_Glyph(font_face->glyph, &glyph)){
+		fprintf(stderr, "Failed to copy glyph, aborting\n");
+		return NULL;
+	}
+
+	//render to bitmap
+	if(FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_MONO, 0, 1)){
+		fprintf(stderr, "Failed to render glyph, aborting\n");
+		FT_Done_Glyph(glyph);
+		return NULL;
+	}
+	bitmap = (FT_BitmapGlyph)glyph;
+
+	//test pixel format
+	if(bitmap->bitmap.pixel_mode != FT_PIXEL_MODE_MONO || bitmap->bitmap.pitch < 0){
+		fprintf(stderr, "Got unsupported pixel format\n");
+		FT_Done_Glyph(glyph);
+		return NULL;
+	}
+
+	//mapped bitmap data is moved to the heap before appending
+	length = bitmap->bitmap.rows * bitmap->bitmap.pitch;
+	if(cache->header.data_length + length > cache->data_size){
+		size = max(cache->data_size * 2, cache->header.data_length + length + 4096);
+		data = calloc(size, 1);
+		if(!data){
+			fprintf(stderr, "Failed to allocate memory\n");
+			FT_Done_Glyph(glyph);
+			return NULL;
+		}
+		if(cache->data){
+			memcpy(data, cache->data, cache->header.data_length);
+		}
+		if(cache->data_size){
+			free(cache->data);
+		}
+		cache->data = data;
+		cache->data_size = size;
+	}
+
+	//extracted glyphs do not carry metrics, take them from the slot
+	entry->codepoint = codepoint;
+	entry->height = font_face->glyph->metrics.height;
+	entry->bearing_y = font_face->glyph->metrics.horiBearingY;
+	entry->advance = font_face->glyph->metrics.horiAdvance;
+	entry->width = bitmap->bitmap.width;
+	entry->rows = bitmap->bitmap.rows;
+	entry->pitch = bitmap->bitmap.pitch;
+	entry->offset = cache->header.data_length;
+	memcpy(cache->data + entry->offset, bitmap->bitmap.buffer, length);
+	cache->header.data_length += length;
+
+	if(!cache->valid[codepoint]){
+		cache->valid[codepoint] = true;
+		cache->header.count++;
+	}
+	cache->dirty = true;
+	FT_Done_Glyph(glyph);
+	return entry;
+}
+
+static bool load_glyphs(char** lines, FT_Face font_face, GLYPH_CACHE* cache, GLYPH*** glyphs){
+	//resolve all strings into glyph arrays, rendering each distinct glyph only once
+	size_t i, c;
+	uint8_t codepoint;
+
+	for(i = 0; lines[i]; i++){
+		for(c = 0; lines[i][c]; c++){
+			codepoint = lines[i][c];
+			glyphs[i][c] = cache->valid[codepoint] ? cache->glyphs + codepoint : glyph_render(cache, font_face, codepoint);
+			if(!glyphs[i][c]){
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//raster lines occupied by a character, including the separator line following it
+static unsigned glyph_columns(GLYPH* glyph){
+	return max(glyph->width, glyph->advance / 64) + 1;
+}
+
+//composite all text lines into a packed framebuffer, pixel p of raster line x is bit p % 64 of word p / 64
+static uint64_t* render(char** lines, size_t line_count, GLYPH_CACHE* cache, GLYPH*** glyphs, unsigned line_height, unsigned width, size_t* raster_lines){
+	int baseline = abs(cache->header.descender / 64);
+	size_t words = (width + 63) / 64, columns, i, c;
+	unsigned x, row, pixel, segment;
+	int baseline_offset;
+	uint64_t* framebuffer;
+	uint8_t* bitmap;
+	GLYPH* current;
+
+	//the label ends with one empty raster line after the longest text line
+	*raster_lines = 0;
+	for(i = 0; i < line_count; i++){
+		columns = 0;
+		for(c = 0; lines[i][c]; c++){
+			columns += glyph_columns(glyphs[i][c]);
+		}
+		*raster_lines = max(*raster_lines, columns);
+	}
+	*raster_lines += 1;
+
+	framebuffer = calloc(*raster_lines * words, sizeof(uint64_t));
+	if(!framebuffer){
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	//TODO kerning (see http://www.freetype.org/freetype2/docs/tutorial/step2.html)
+	//the lowest text line is rendered at the start of each raster line
+	for(i = 0; i < line_count; i++){
+		segment = (line_count - 1 - i) * line_height;
+		x = 0;
+		for(c = 0; lines[i][c]; c++){
+			current = glyphs[i][c];
+			bitmap = cache->data + current->offset;
+			baseline_offset = max(0, baseline - (current->height - current->bearing_y) / 64);
+
+			for(row = 0; row < current->rows; row++){
+				//bitmap rows run top to bottom, pixels bottom to top
+				pixel = baseline_offset + (current->rows - 1 - row);
+				if(pixel >= line_height){
+					continue;
+				}
+				pixel += segment;
+
+				for(columns = 0; columns < current->width; columns++){
+					if(bitmap[row * current->pitch + columns / 8] & (0x80 >> (columns % 8))){
+						framebuffer[(x + columns) * words + pixel / 64] |= 1ULL << (pixel % 64);
+					}
+				}
+			}
+			x += glyph_columns(current);
+		}
+	}
+
+	return framebuffer;
+}
+
+//drop all glyphs, eg. when the size changes, storing new ones for later runs
+static void glyph_cache_reset(TEXT_RENDERER* renderer){
+	GLYPH_CACHE_HEADER header = renderer->cache.header;
+
+	if(renderer->cache_path && renderer->cache.dirty){
+		glyph_cache_store(&(renderer->cache), renderer->cache_path);
+	}
+	glyph_cache_free(&(renderer->cache));
+	free(renderer->cache_path);
+	renderer->cache_path = NULL;
+
+	memset(&(renderer->cache), 0, sizeof(GLYPH_CACHE));
+	memcpy(renderer->cache.header.font_file, header.font_file, sizeof(header.font_file));
+	renderer->cache.header.font_mtime = header.font_mtime;
+	renderer->cache.header.font_size = header.font_size;
+}
+
+//resolve and open the font, previously resolved fonts are opened without initializing fontconfig
+bool text_renderer_font(TEXT_RENDERER* renderer){
+	FONT_LOCATION location = {
+		.index = 0
+	};
+	bool resolved = false;
+	int64_t stamp = 0;
+
+	if(!renderer->freetype){
+		if(FT_Init_FreeType(&(renderer->ft))){
+			fprintf(stderr, "Failed to initialize FreeType\n");
+			return false;
+		}
+		renderer->freetype = true;
+	}
+
+	if(renderer->resolved){
+		location = renderer->location;
+		resolved = true;
+	}
+
+	if(!resolved && renderer->font_cache){
+		stamp = fontconfig_stamp();
+		resolved = font_cache_lookup(renderer->font_cache, renderer->fontspec, stamp, &location);
+	}
+
+	if(!resolved){
+		if(!renderer->fontconfig){
+			if(!FcInit()){
+				fprintf(stderr, "Failed to initialize FontConfig\n");
+				return false;
+			}
+			renderer->fontconfig = true;
+		}
+		resolved = resolve_font(renderer->fontspec, &location);
+		if(resolved && renderer->font_cache){
+			font_cache_store(renderer->font_cache, renderer->fontspec, stamp, &location);
+		}
+	}
+
+	if(!resolved){
+		return false;
+	}
+	renderer->location = location;
+	renderer->resolved = true;
+	return load_font(renderer->ft, &location, &(renderer->face), &(renderer->cache.header));
+}
+
+//renderer for another thread, opening the font already resolved by the given renderer
+//fontconfig is process-global, so shared renderers never initialize or finalize it,
+//the font fails to open if the given renderer could not resolve it
+TEXT_RENDERER text_renderer_share(TEXT_RENDERER* renderer){
+	return (TEXT_RENDERER){
+		.fontspec = renderer->fontspec,
+		.font_cache = renderer->font_cache,
+		.resolved = true,
+		.location = renderer->location
+	};
+}
+
+//render text lines into a packed framebuffer of the given width, see render()
+uint64_t* text_render(TEXT_RENDERER* renderer, char** lines, unsigned width, size_t* raster_lines){
+	size_t i, line_count = stored_lines(lines), characters = 0;
+	unsigned line_height;
+	GLYPH*** glyphs = NULL;
+	GLYPH** glyph_arena;
+	uint64_t* framebuffer = NULL;
+
+	if(!line_count || !width || width < line_count){
+		fprintf(stderr, "Invalid text layout (%zu lines, width %d)\n", line_count, width);
+		return NULL;
+	}
+
+	//calculate required sizes, remaining pixels are left blank
+	line_height = width / line_count;
+	for(i = 0; i < line_count; i++){
+		characters += strlen(lines[i]);
+	}
+
+	if(!renderer->face && !text_renderer_font(renderer)){
+		return NULL;
+	}
+
+	if(renderer->height != line_height){
+		glyph_cache_reset(renderer);
+
+		//fprintf(stderr, "Setting glyph sizes to %d pixels\n", line_height);
+		if(FT_Set_Pixel_Sizes(renderer->face, 0, line_height)){
+			fprintf(stderr, "Failed to set glyph size %d - font might not offer that size or might not be scalable\n", line_height);
+			renderer->height = 0;
+			return NULL;
+		}
+		renderer->height = line_height;
+
+		//baseline of the font is the absolute of the lowest descender
+		renderer->cache.header.height = line_height;
+		renderer->cache.header.descender = renderer->face->size->metrics.descender;
+
+		//glyphs rendered by previous runs skip rasterization
+		if(renderer->glyph_cache){
+			renderer->cache_path = glyph_cache_path(renderer->glyph_cache, renderer->fontspec, line_height);
+			if(renderer->cache_path){
+				glyph_cache_load(&(renderer->cache), renderer->cache_path);
+			}
+		}
+	}
+
+	//allocate glyph buffer, the per-line arrays share a single allocation
+	glyphs = calloc(1, line_count * sizeof(GLYPH**) + characters * sizeof(GLYPH*));
+	if(!glyphs){
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	glyph_arena = (GLYPH**)(glyphs + line_count);
+	for(i = 0; i < line_count; i++){
+		glyphs[i] = glyph_arena;
+		glyph_arena += strlen(lines[i]);
+	}
+
+	if(load_glyphs(lines, renderer->face, &(renderer->cache), glyphs)){
+		framebuffer = render(lines, line_count, &(renderer->cache), glyphs, line_height, width, raster_lines);
+	}
+	free(glyphs);
+
+	if(renderer->cache_path && renderer->cache.dirty){
+		glyph_cache_store(&(renderer->cache), renderer->cache_path);
+		renderer->cache.dirty = false;
+	}
+	return framebuffer;
+}
+
+void text_renderer_free(TEXT_RENDERER* renderer){
+	glyph_cache_reset(renderer);
+	if(renderer->face){
+		FT_Done_Face(renderer->face);
+		renderer->face = NULL;
+	}
+	if(renderer->freetype){
+		FT_Done_FreeType(renderer->ft);
+		renderer->freetype = false;
+	}
+	if(renderer->fontconfig){
+		FcFini();
+		renderer->fontconfig = false;
+	}
+	renderer->height = 0;
+}
@@ -0,0 +1,67 @@
+#define GLYPH_CACHE_MAGIC	"PTGLYPH1"
+#define FONT_PATH_LENGTH	256
+
+typedef struct /*_FONT_LOCATION*/ {
+	char file[FONT_PATH_LENGTH];
+	int index;
+} FONT_LOCATION;
+
+//rendered mono glyph bitmap and the metrics required for layout (26.6 fixed point)
+typedef struct /*_GLYPH*/ {
+	uint32_t codepoint;
+	int32_t height;
+	int32_t bearing_y;
+	int32_t advance;
+	uint32_t width;
+	uint32_t rows;
+	uint32_t pitch;
+	uint32_t offset;
+} GLYPH;
+
+//glyph cache file header, followed by the glyph table and the bitmap data
+typedef struct /*_GLYPH_CACHE_HEADER*/ {
+	char magic[8];
+	uint32_t height;
+	int32_t descender;
+	int64_t font_mtime;
+	int64_t font_size;
+	uint32_t count;
+	uint32_t data_length;
+	char font_file[FONT_PATH_LENGTH];
+} GLYPH_CACHE_HEADER;
+
+typedef struct /*_GLYPH_CACHE*/ {
+	GLYPH_CACHE_HEADER header;
+	bool valid[256];
+	GLYPH glyphs[256];
+	uint8_t* data;
+	size_t data_size;
+	bool dirty;
+	void* map;
+	size_t map_length;
+} GLYPH_CACHE;
+
+//font, glyph cache and size state kept across render calls
+typedef struct /*_TEXT_RENDERER*/ {
+	char* fontspec;
+	char* glyph_cache;
+	char* font_cache;
+	bool freetype;
+	bool fontconfig;
+	//font resolved by this renderer or handed over from another one, see text_renderer_share
+	bool resolved;
+	FONT_LOCATION location;
+	FT_Library ft;
+	FT_Face face;
+	unsigned height;
+	GLYPH_CACHE cache;
+	char* cache_path;
+} TEXT_RENDERER;
+
+size_t stored_lines(char** lines);
+int text_split(char* text, char*** lines);
+void text_free_lines(char** lines);
+bool text_renderer_font(TEXT_RENDERER* renderer);
+TEXT_RENDERER text_renderer_share(TEXT_RENDERER* renderer);
+uint64_t* text_render(TEXT_RENDERER* renderer, char** lines, unsigned width, size_t* raster_lines);
+void text_renderer_free(TEXT_RENDERER* renderer);